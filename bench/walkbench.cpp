@@ -0,0 +1,552 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gbuilder.h"
+
+/* Measures how fast a walker gets through the AST with the kind tag
+ * dispatch of AstWalker, against the double virtual dispatch it replaced,
+ * where each node's accept called back into a virtual visit on the walker.
+ * The old scheme is rebuilt here on copies of the node classes with the
+ * same fields. Both trees are built from one plan, so they have the same
+ * shape: functions made of nested blocks holding instructions, labels,
+ * data, returns and expression statements.
+ *
+ * It also times sorting the tree's assembly lines by kind, as the passes
+ * over the assembly do for every line, with dynamic_cast and with the tags.
+ *
+ * Built with "make walkbench" and run as: walkbench [nodes] [rounds]
+ */
+
+/* ************************************************************ *
+ * THE TREE TO WALK                                             *
+ * ************************************************************ */
+
+enum class Step {
+    Open, Close, Instruction, Label, Data, Return, Expression
+};
+
+// the statements of the tree in the order they are met, with blocks opened
+// and closed around the statements they hold
+static std::vector<Step> makePlan(size_t nodes) {
+    std::vector<Step> plan;
+    unsigned seed = 12345;
+    size_t made = 0;
+    int depth = 0;
+    while (made < nodes || depth > 0) {
+        seed = seed * 1103515245 + 12345;
+        unsigned pick = (seed >> 16) % 32;
+        if (depth == 0) {
+            plan.push_back(Step::Open);
+            ++depth;
+        } else if (made >= nodes || (pick == 0 && depth > 1) || pick == 1) {
+            plan.push_back(Step::Close);
+            --depth;
+        } else if (pick == 2 && depth < 6) {
+            plan.push_back(Step::Open);
+            ++depth;
+        } else if (pick < 22) {
+            plan.push_back(Step::Instruction);
+        } else if (pick < 25) {
+            plan.push_back(Step::Label);
+        } else if (pick < 27) {
+            plan.push_back(Step::Data);
+        } else if (pick < 29) {
+            // a return and the expression it returns
+            plan.push_back(Step::Return);
+            ++made;
+        } else {
+            plan.push_back(Step::Expression);
+            ++made;
+        }
+        ++made;
+    }
+    return plan;
+}
+
+static const AsmCode &benchCode = opcodeByName("add");
+
+
+/* ************************************************************ *
+ * KIND TAG DISPATCH                                            *
+ * ************************************************************ */
+
+class TagWalker : public AstWalker<TagWalker> {
+public:
+    TagWalker()
+    : total(0)
+    { }
+
+    void visit(AsmStatement *stmt) {
+        total += stmt->code->opcode + stmt->operands.size();
+    }
+    void visit(AsmData *stmt) {
+        total += stmt->data.size();
+    }
+    void visit(LabelStmt *stmt) {
+        total += stmt->name.getId();
+    }
+    void visit(CodeBlock *stmt) {
+        for (StatementDef *s : stmt->statements) {
+            walk(s);
+        }
+    }
+    void visit(ReturnDef *stmt) {
+        walk(stmt->retValue);
+    }
+    void visit(ExpressionStmt *stmt) {
+        walk(stmt->expr);
+    }
+    void visit(NameExpression *expr) {
+        total += expr->value.value;
+    }
+    void visit(LiteralExpression *expr) {
+        total += expr->litValue;
+    }
+    void visit(PrefixOpExpression *expr) {
+        walk(expr->right);
+    }
+
+    long long total;
+};
+
+static std::vector<CodeBlock*> buildTagTree(const std::vector<Step> &plan, Arena &arena) {
+    std::vector<CodeBlock*> functions;
+    std::vector<CodeBlock*> open;
+    Name label("label");
+    for (Step step : plan) {
+        StatementDef *stmt = nullptr;
+        switch (step) {
+            case Step::Open: {
+                CodeBlock *block = arena.make<CodeBlock>();
+                if (open.empty()) {
+                    functions.push_back(block);
+                } else {
+                    open.back()->statements.push_back(block);
+                }
+                open.push_back(block);
+                continue;
+            }
+            case Step::Close:
+                open.pop_back();
+                continue;
+            case Step::Instruction: {
+                AsmStatement *asmStmt = arena.make<AsmStatement>();
+                asmStmt->code = &benchCode;
+                for (int i = 0; i < 3; ++i) {
+                    AsmOperand *op = arena.make<AsmOperand>();
+                    op->value = arena.make<Value>(i + 1);
+                    asmStmt->operands.push_back(op);
+                }
+                stmt = asmStmt;
+                break;
+            }
+            case Step::Label:
+                stmt = arena.make<LabelStmt>(label);
+                break;
+            case Step::Data: {
+                AsmData *data = arena.make<AsmData>();
+                data->pushWord(0);
+                stmt = data;
+                break;
+            }
+            case Step::Return: {
+                ReturnDef *ret = arena.make<ReturnDef>();
+                LiteralExpression *lit = arena.make<LiteralExpression>();
+                lit->litValue = 1;
+                ret->retValue = lit;
+                stmt = ret;
+                break;
+            }
+            case Step::Expression: {
+                ExpressionStmt *expr = arena.make<ExpressionStmt>();
+                NameExpression *name = arena.make<NameExpression>();
+                name->value.value = 2;
+                expr->expr = name;
+                stmt = expr;
+                break;
+            }
+        }
+        open.back()->statements.push_back(stmt);
+    }
+    return functions;
+}
+
+
+/* ************************************************************ *
+ * DOUBLE VIRTUAL DISPATCH                                      *
+ * ************************************************************ */
+
+namespace virtualdispatch {
+
+class Instruction;
+class Data;
+class Label;
+class Block;
+class Return;
+class ExprStmt;
+class NameExpr;
+class LiteralExpr;
+
+class Walker {
+public:
+    virtual ~Walker() { }
+    virtual void visit(Instruction *stmt) = 0;
+    virtual void visit(Data *stmt) = 0;
+    virtual void visit(Label *stmt) = 0;
+    virtual void visit(Block *stmt) = 0;
+    virtual void visit(Return *stmt) = 0;
+    virtual void visit(ExprStmt *stmt) = 0;
+};
+
+class ExprWalker {
+public:
+    virtual ~ExprWalker() { }
+    virtual void visit(NameExpr *expr) = 0;
+    virtual void visit(LiteralExpr *expr) = 0;
+};
+
+class Statement {
+public:
+    virtual ~Statement() { }
+    virtual void accept(Walker *walker) = 0;
+};
+
+class Expr {
+public:
+    virtual ~Expr() { }
+    virtual void accept(ExprWalker *walker) = 0;
+};
+
+class Instruction : public Statement {
+public:
+    virtual void accept(Walker *walker) {
+        walker->visit(this);
+    }
+    int pos;
+    const AsmCode *code;
+    Origin origin;
+    std::vector<AsmOperand*> operands;
+};
+
+class Data : public Statement {
+public:
+    virtual void accept(Walker *walker) {
+        walker->visit(this);
+    }
+    int pos;
+    std::vector<unsigned char> data;
+};
+
+class Label : public Statement {
+public:
+    Label(const Name &name)
+    : name(name)
+    { }
+    virtual void accept(Walker *walker) {
+        walker->visit(this);
+    }
+    int pos;
+    Name name;
+};
+
+class Block : public Statement {
+public:
+    virtual void accept(Walker *walker) {
+        walker->visit(this);
+    }
+    SymbolTable locals;
+    std::vector<Statement*> statements;
+    Origin origin;
+};
+
+class Return : public Statement {
+public:
+    virtual void accept(Walker *walker) {
+        walker->visit(this);
+    }
+    Expr *retValue;
+};
+
+class ExprStmt : public Statement {
+public:
+    virtual void accept(Walker *walker) {
+        walker->visit(this);
+    }
+    Expr *expr;
+};
+
+class NameExpr : public Expr {
+public:
+    virtual void accept(ExprWalker *walker) {
+        walker->visit(this);
+    }
+    Name name;
+    Value value;
+};
+
+class LiteralExpr : public Expr {
+public:
+    virtual void accept(ExprWalker *walker) {
+        walker->visit(this);
+    }
+    int litValue;
+};
+
+class CountingWalker : public Walker, public ExprWalker {
+public:
+    CountingWalker()
+    : total(0)
+    { }
+
+    virtual void visit(Instruction *stmt) {
+        total += stmt->code->opcode + stmt->operands.size();
+    }
+    virtual void visit(Data *stmt) {
+        total += stmt->data.size();
+    }
+    virtual void visit(Label *stmt) {
+        total += stmt->name.getId();
+    }
+    virtual void visit(Block *stmt) {
+        for (Statement *s : stmt->statements) {
+            s->accept(this);
+        }
+    }
+    virtual void visit(Return *stmt) {
+        stmt->retValue->accept(this);
+    }
+    virtual void visit(ExprStmt *stmt) {
+        stmt->expr->accept(this);
+    }
+    virtual void visit(NameExpr *expr) {
+        total += expr->value.value;
+    }
+    virtual void visit(LiteralExpr *expr) {
+        total += expr->litValue;
+    }
+
+    long long total;
+};
+
+static std::vector<Block*> buildTree(const std::vector<Step> &plan, Arena &arena) {
+    std::vector<Block*> functions;
+    std::vector<Block*> open;
+    Name label("label");
+    for (Step step : plan) {
+        Statement *stmt = nullptr;
+        switch (step) {
+            case Step::Open: {
+                Block *block = arena.make<Block>();
+                if (open.empty()) {
+                    functions.push_back(block);
+                } else {
+                    open.back()->statements.push_back(block);
+                }
+                open.push_back(block);
+                continue;
+            }
+            case Step::Close:
+                open.pop_back();
+                continue;
+            case Step::Instruction: {
+                Instruction *asmStmt = arena.make<Instruction>();
+                asmStmt->code = &benchCode;
+                for (int i = 0; i < 3; ++i) {
+                    AsmOperand *op = arena.make<AsmOperand>();
+                    op->value = arena.make<Value>(i + 1);
+                    asmStmt->operands.push_back(op);
+                }
+                stmt = asmStmt;
+                break;
+            }
+            case Step::Label:
+                stmt = arena.make<Label>(label);
+                break;
+            case Step::Data: {
+                Data *data = arena.make<Data>();
+                data->data.assign(4, 0);
+                stmt = data;
+                break;
+            }
+            case Step::Return: {
+                Return *ret = arena.make<Return>();
+                LiteralExpr *lit = arena.make<LiteralExpr>();
+                lit->litValue = 1;
+                ret->retValue = lit;
+                stmt = ret;
+                break;
+            }
+            case Step::Expression: {
+                ExprStmt *expr = arena.make<ExprStmt>();
+                NameExpr *name = arena.make<NameExpr>();
+                name->value.value = 2;
+                expr->expr = name;
+                stmt = expr;
+                break;
+            }
+        }
+        open.back()->statements.push_back(stmt);
+    }
+    return functions;
+}
+
+}
+
+
+/* ************************************************************ *
+ * SORTING LINES BY KIND                                        *
+ * ************************************************************ */
+
+static void collectLines(StatementDef *stmt, std::vector<AsmLine*> &lines) {
+    if (CodeBlock *block = nodeAs<CodeBlock>(stmt)) {
+        for (StatementDef *s : block->statements) {
+            collectLines(s, lines);
+        }
+    } else if (stmt->kind == StatementDef::Instruction || stmt->kind == StatementDef::Data
+            || stmt->kind == StatementDef::Label) {
+        lines.push_back(static_cast<AsmLine*>(stmt));
+    }
+}
+
+class LineCounts {
+public:
+    LineCounts()
+    : instructions(0), data(0), labels(0)
+    { }
+
+    long long total() const {
+        return instructions * 3 + data * 5 + labels * 7;
+    }
+
+    long long instructions, data, labels;
+};
+
+static long long sortWithCasts(const std::vector<AsmLine*> &lines) {
+    LineCounts counts;
+    for (AsmLine *line : lines) {
+        if (dynamic_cast<AsmStatement*>(line)) {
+            ++counts.instructions;
+        } else if (dynamic_cast<AsmData*>(line)) {
+            ++counts.data;
+        } else if (dynamic_cast<LabelStmt*>(line)) {
+            ++counts.labels;
+        }
+    }
+    return counts.total();
+}
+
+static long long sortWithTags(const std::vector<AsmLine*> &lines) {
+    LineCounts counts;
+    for (AsmLine *line : lines) {
+        if (nodeAs<AsmStatement>(line)) {
+            ++counts.instructions;
+        } else if (nodeAs<AsmData>(line)) {
+            ++counts.data;
+        } else if (nodeAs<LabelStmt>(line)) {
+            ++counts.labels;
+        }
+    }
+    return counts.total();
+}
+
+
+/* ************************************************************ *
+ * TIMING                                                       *
+ * ************************************************************ */
+
+// the fastest of several rounds, in seconds
+template<class Walk>
+static double bestTime(int rounds, long long &total, const Walk &walk) {
+    double best = 0.0;
+    for (int i = 0; i < rounds; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        total = walk();
+        std::chrono::duration<double> taken = std::chrono::steady_clock::now() - start;
+        if (i == 0 || taken.count() < best) {
+            best = taken.count();
+        }
+    }
+    return best;
+}
+
+static void report(const char *name, double seconds, size_t nodes) {
+    std::cout << std::left << std::setw(26) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << seconds * 1000.0 << " ms"
+              << std::setw(10) << seconds * 1e9 / nodes << " ns/node"
+              << std::setw(10) << nodes / seconds / 1e6 << " Mnodes/s\n";
+}
+
+int main(int argc, char *argv[]) {
+    size_t nodes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    if (nodes == 0 || rounds < 1) {
+        std::cerr << "usage: walkbench [nodes] [rounds]\n";
+        return 1;
+    }
+
+    std::vector<Step> plan = makePlan(nodes);
+    size_t count = plan.size();
+    for (Step step : plan) {
+        if (step == Step::Return || step == Step::Expression) {
+            // the expression under the statement
+            ++count;
+        } else if (step == Step::Close) {
+            --count;
+        }
+    }
+
+    Arena tagArena, virtualArena;
+    std::vector<CodeBlock*> tagTree = buildTagTree(plan, tagArena);
+    std::vector<virtualdispatch::Block*> virtualTree = virtualdispatch::buildTree(plan, virtualArena);
+    std::cout << "walking " << count << " nodes in " << tagTree.size() << " functions, best of "
+              << rounds << " rounds\n";
+
+    long long virtualTotal = 0, tagTotal = 0;
+    double virtualTime = bestTime(rounds, virtualTotal, [&virtualTree]() {
+        virtualdispatch::CountingWalker walker;
+        for (virtualdispatch::Block *block : virtualTree) {
+            block->accept(&walker);
+        }
+        return walker.total;
+    });
+    double tagTime = bestTime(rounds, tagTotal, [&tagTree]() {
+        TagWalker walker;
+        for (CodeBlock *block : tagTree) {
+            walker.walk(block);
+        }
+        return walker.total;
+    });
+
+    report("virtual accept and visit", virtualTime, count);
+    report("kind tag switch", tagTime, count);
+    std::cout << "speedup " << std::setprecision(2) << virtualTime / tagTime << "x\n";
+    if (virtualTotal != tagTotal) {
+        std::cerr << "the walks disagree: " << virtualTotal << " and " << tagTotal << '\n';
+        return 1;
+    }
+
+    std::vector<AsmLine*> lines;
+    for (CodeBlock *block : tagTree) {
+        collectLines(block, lines);
+    }
+    std::cout << "\nsorting " << lines.size() << " assembly lines by kind\n";
+    long long castTotal = 0, kindTotal = 0;
+    double castTime = bestTime(rounds, castTotal, [&lines]() {
+        return sortWithCasts(lines);
+    });
+    double kindTime = bestTime(rounds, kindTotal, [&lines]() {
+        return sortWithTags(lines);
+    });
+    report("dynamic_cast", castTime, lines.size());
+    report("kind tag", kindTime, lines.size());
+    std::cout << "speedup " << std::setprecision(2) << castTime / kindTime << "x\n";
+    if (castTotal != kindTotal) {
+        std::cerr << "the sorts disagree: " << castTotal << " and " << kindTotal << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "arena.h"
+
+Arena::~Arena() {
+    for (auto i = destructors.rbegin(); i != destructors.rend(); ++i) {
+        i->destroy(i->object);
+    }
+    for (char *block : blocks) {
+        std::free(block);
+    }
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    size_t padding = -reinterpret_cast<uintptr_t>(next) & (alignment - 1);
+    if (next == nullptr || padding + size > remaining) {
+        // objects too big to share a block get one of their own
+        size_t newSize = size + alignment > blockSize ? size + alignment : blockSize;
+        char *block = static_cast<char*>(std::malloc(newSize));
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back(block);
+        next = block;
+        remaining = newSize;
+        padding = -reinterpret_cast<uintptr_t>(next) & (alignment - 1);
+    }
+
+    char *result = next + padding;
+    next += padding + size;
+    remaining -= padding + size;
+    return result;
+}
+
+// Takes over ownership of everything allocated from another arena, leaving
+// it empty.
+void Arena::adopt(Arena &other) {
+    blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+    destructors.insert(destructors.end(), other.destructors.begin(), other.destructors.end());
+    other.blocks.clear();
+    other.destructors.clear();
+    other.next = nullptr;
+    other.remaining = 0;
+}
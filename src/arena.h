@@ -0,0 +1,56 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* Owns the nodes created during a compilation. Memory is handed out from
+ * large blocks in the order it is asked for and everything is released at
+ * once when the arena is destroyed. Objects that need their destructor run
+ * are remembered and destroyed, newest first, before the blocks are freed.
+ */
+class Arena {
+public:
+    Arena()
+    : next(nullptr), remaining(0)
+    { }
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    template<class T, class... Args>
+    T* make(Args&&... args) {
+        void *memory = allocate(sizeof(T), alignof(T));
+        T *object = new(memory) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            destructors.push_back(Destructor{object, &destroy<T>});
+        }
+        return object;
+    }
+
+    void* allocate(size_t size, size_t alignment);
+    void adopt(Arena &other);
+
+private:
+    static const size_t blockSize = 64 * 1024;
+
+    template<class T>
+    static void destroy(void *object) {
+        static_cast<T*>(object)->~T();
+    }
+
+    struct Destructor {
+        void *object;
+        void (*destroy)(void*);
+    };
+
+    char *next;
+    size_t remaining;
+    std::vector<char*> blocks;
+    std::vector<Destructor> destructors;
+};
+
+#endif
@@ -1,7 +1,17 @@
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 #include "gbuilder.h"
+#include "flatcode.h"
+#include "encode.h"
+
+/* ************************************************************ *
+ * OPCODES                                                      *
+ * ************************************************************ */
 
-static AsmCode codes[] = {
+static constexpr AsmCode codes[] = {
     AsmCode("nop",           0x00,  0),
     AsmCode("quit",          0x120, 0),
     AsmCode("glk",           0x130, 3),
@@ -47,7 +57,7 @@ static AsmCode codes[] = {
     AsmCode("bitand",        0x18,  3),
     AsmCode("bitor",         0x19,  3),
     AsmCode("bitxor",        0x1A,  3),
-    AsmCode("bitnot",        0x1B,  3),
+    AsmCode("bitnot",        0x1B,  2),
     AsmCode("shiftl",        0x1C,  3),
     AsmCode("sshiftr",       0x1D,  3),
     AsmCode("ushiftr",       0x1E,  3),
@@ -101,14 +111,14 @@ static AsmCode codes[] = {
     AsmCode("jgeu",          0x2B,  3, true),
     AsmCode("jgtu",          0x2C,  3, true),
     AsmCode("jleu",          0x2D,  3, true),
-    AsmCode("jumpabs",       0x2D,  1),
+    AsmCode("jumpabs",       0x104, 1),
 
     // function calls
     AsmCode("call",          0x30,  3),
     AsmCode("return",        0x31,  1),
-    AsmCode("catch",         0x32,  2),
+    AsmCode("catch",         0x32,  2, true),
     AsmCode("throw",         0x33,  2),
-    AsmCode("tailcall",      0x30,  2),
+    AsmCode("tailcall",      0x34,  2),
     AsmCode("callf",         0x160, 2),
     AsmCode("callfi",        0x161, 3),
     AsmCode("callfii",       0x162, 4),
@@ -145,16 +155,115 @@ static AsmCode codes[] = {
     AsmCode(nullptr,         0,     0)
 };
 
-const AsmCode& opcodeByName(const std::string &name) {
-    for (int i = 0; ; ++i) {
-        if (codes[i].name == nullptr || name == codes[i].name) {
-            return codes[i];
+// the number of opcodes, not counting the end marker
+static constexpr unsigned codeCount = sizeof(codes) / sizeof(codes[0]) - 1;
+
+static constexpr unsigned textLength(const char *text) {
+    unsigned length = 0;
+    while (text[length]) {
+        ++length;
+    }
+    return length;
+}
+
+static constexpr bool sameText(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return *a == *b;
+}
+
+static constexpr bool namesUnique() {
+    for (unsigned i = 0; i < codeCount; ++i) {
+        for (unsigned j = i + 1; j < codeCount; ++j) {
+            if (sameText(codes[i].name, codes[j].name)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+static_assert(namesUnique(), "two opcodes have the same name");
+
+static constexpr bool opcodesUnique() {
+    for (unsigned i = 0; i < codeCount; ++i) {
+        for (unsigned j = i + 1; j < codeCount; ++j) {
+            if (codes[i].opcode == codes[j].opcode) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+static_assert(opcodesUnique(), "two mnemonics have the same opcode");
+
+
+/* ************************************************************ *
+ * MNEMONIC LOOKUP                                              *
+ * ************************************************************ */
+
+/* Mnemonics are found with a perfect hash built when compiling: seeds are
+ * tried until one sends every mnemonic to a slot of its own, so a lookup
+ * is one hash and one comparison.
+ */
+static constexpr unsigned mnemonicSlots = 4096;
+
+static constexpr uint32_t mnemonicHash(const char *text, unsigned length, uint32_t seed) {
+    uint32_t hash = seed;
+    for (unsigned i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+    }
+    return hash & (mnemonicSlots - 1);
+}
+
+class MnemonicTable {
+public:
+    // zero if no seed worked
+    uint32_t seed;
+    // the index in codes of the mnemonic in each slot, or -1
+    short slots[mnemonicSlots];
+};
+
+static constexpr MnemonicTable buildMnemonicTable() {
+    MnemonicTable table = {};
+    for (uint32_t seed = 2166136261u; seed < 2166136261u + 1000; ++seed) {
+        for (unsigned slot = 0; slot < mnemonicSlots; ++slot) {
+            table.slots[slot] = -1;
+        }
+        bool placed = true;
+        for (unsigned i = 0; i < codeCount && placed; ++i) {
+            unsigned slot = mnemonicHash(codes[i].name, textLength(codes[i].name), seed);
+            if (table.slots[slot] >= 0) {
+                placed = false;
+            }
+            table.slots[slot] = i;
+        }
+        if (placed) {
+            table.seed = seed;
+            return table;
         }
     }
-    return codes[0];
+    table.seed = 0;
+    return table;
+}
+
+static constexpr MnemonicTable mnemonics = buildMnemonicTable();
+static_assert(mnemonics.seed != 0, "no perfect hash found for the mnemonics");
+
+const AsmCode& opcodeByName(const std::string &name) {
+    int index = mnemonics.slots[mnemonicHash(name.data(), name.size(), mnemonics.seed)];
+    if (index >= 0 && name == codes[index].name) {
+        return codes[index];
+    }
+    return codes[codeCount];
 }
 
 
+/* ************************************************************ *
+ * SIZES                                                        *
+ * ************************************************************ */
+
 int AsmOperand::getSize() {
     if (mySize >= 0) return mySize;
 
@@ -163,10 +272,11 @@ int AsmOperand::getSize() {
         return 0;
     }
 
-    if (value->type == Value::Identifier) {
+    if (value->type == Value::Identifier || value->type == Value::String) {
+        // the layout pass in build_game chooses sizes for label references
         mySize = 4;
     } else if (value->type == Value::Constant && !isIndirect) {
-        if (value == 0) {
+        if (value->value == 0) {
             mySize = 0;
         } else if (value->value >= -128 && value->value <= 127) {
             mySize = 1;
@@ -188,53 +298,12 @@ int AsmOperand::getSize() {
     return mySize;
 }
 
-int AsmOperand::getMode() {
-    if (isStack) return 8;
-
-    int sizeMode = 0;
-    switch(getSize()) {
-        case 0: sizeMode = 0;   break;
-        case 1: sizeMode = 1;   break;
-        case 2: sizeMode = 2;   break;
-        case 4: sizeMode = 3;   break;
-    }
-
-    if (!isIndirect && value->type == Value::Constant && value->value == 0) {
-        return 0;
-    }
-
-    if (isIndirect) {
-        return 4 + sizeMode;
-    } else if (value->type == Value::Local) {
-        return 8 + sizeMode;
-    } else { // Identifier & Constant
-        return sizeMode;
-    }
-}
-
-
 int AsmStatement::getSize() const {
-    int size = 0;
-
-    // size of opcode
-    if (opcode > 0x3FFF) {
-        size += 4;
-    } else if (opcode > 0x7F) {
-        size += 2;
-    } else {
-        size += 1;
-    }
-
-    // size of addressing modes
-    size += operands.size() / 2;
-    if (operands.size() % 2) {
-        ++size;
+    std::vector<FlatOperand> flat;
+    for (AsmOperand *op : operands) {
+        flat.push_back(flattenOperand(op, nullptr));
     }
-
-    // size of operands
-    for (auto op : operands) {
-        size += op->getSize();
-    }
-
-    return size;
+    SizeCounter counter;
+    encodeInstruction(counter, *code, flat.data(), flat.size());
+    return counter.size;
 }
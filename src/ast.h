@@ -1,7 +1,11 @@
+#include <cassert>
+#include <cstdint>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
+class AsmCode;
 class AsmOperand;
 class AsmStatement;
 class AsmData;
@@ -16,56 +20,50 @@ class LiteralExpression;
 class ExpressionDef;
 class PrefixOpExpression;
 
-class AstWalker {
-public:
-    virtual void visit(Value *stmt) = 0;
-    virtual void visit(AsmStatement *stmt) = 0;
-    virtual void visit(ExpressionStmt *stmt) = 0;
-    virtual void visit(AsmData *stmt) = 0;
-    virtual void visit(CodeBlock *stmt) = 0;
-    virtual void visit(FunctionDef *stmt) = 0;
-    virtual void visit(ReturnDef *stmt) = 0;
-    virtual void visit(LabelStmt *stmt) = 0;
-};
-
-class AsmWalker {
-public:
-    virtual void visit(Value *stmt) = 0;
-    virtual void visit(AsmStatement *stmt) = 0;
-    virtual void visit(AsmData *stmt) = 0;
-    virtual void visit(LabelStmt *stmt) = 0;
-};
-
-class ExpressionWalker {
-public:
-    virtual void visit(NameExpression *expr) = 0;
-    virtual void visit(LiteralExpression *expr) = 0;
-    virtual void visit(PrefixOpExpression *expr) = 0;
-};
-
+/* Every statement carries a tag saying which kind it is, so walkers and
+ * passes can tell statements apart with a compare instead of a virtual call
+ * or a dynamic_cast.
+ */
 class StatementDef {
 public:
+    enum Kind : uint8_t {
+        Expression, Block, Return, Data, Instruction, Label
+    };
+
+    StatementDef(Kind kind)
+    : kind(kind)
+    { }
     virtual ~StatementDef() {
     }
-    virtual void accept(AstWalker *walker) = 0;
+
+    const Kind kind;
 };
 
+// the statement as a T, or nullptr if it is some other kind of statement
+template<class T>
+T* nodeAs(StatementDef *stmt) {
+    return stmt && stmt->kind == T::nodeKind ? static_cast<T*>(stmt) : nullptr;
+}
+
 class ExpressionStmt : public StatementDef {
 public:
+    static const Kind nodeKind = Expression;
+
+    ExpressionStmt()
+    : StatementDef(nodeKind), expr(nullptr)
+    { }
     virtual ~ExpressionStmt() {
     }
-    virtual void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
 
-    std::shared_ptr<ExpressionDef> expr;
+    ExpressionDef *expr;
 };
 
 class AsmLine : public StatementDef {
 public:
+    AsmLine(Kind kind)
+    : StatementDef(kind)
+    { }
     virtual ~AsmLine() { };
-    virtual void accept(AstWalker *walker) = 0;
-    virtual void accept(AsmWalker *walker) = 0;
 
     virtual int getSize() const = 0;
     int pos;
@@ -81,22 +79,20 @@ public:
     { }
 
     int getSize();
-    int getMode();
 
-    std::shared_ptr<Value> value;
+    Value *value;
     bool isStack;
     bool isIndirect;
     int mySize;
 };
 class AsmData : public AsmLine {
 public:
+    static const Kind nodeKind = Data;
+
+    AsmData()
+    : AsmLine(nodeKind)
+    { }
     virtual ~AsmData() { };
-    virtual void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
-    virtual void accept(AsmWalker *walker) {
-        walker->visit(this);
-    }
 
     void pushByte(unsigned word) {
         data.push_back(word & 0xFF);
@@ -121,60 +117,59 @@ public:
 
 class AsmStatement : public AsmLine {
 public:
+    static const Kind nodeKind = Instruction;
+
+    AsmStatement()
+    : AsmLine(nodeKind), code(nullptr)
+    { }
     virtual ~AsmStatement() {
     }
-    virtual void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
-    virtual void accept(AsmWalker *walker) {
-        walker->visit(this);
-    }
 
+    // the encoded length, worked out from the operands' current sizes
     virtual int getSize() const;
 
-    std::string opname;
-    int opcode;
-    bool isRelative;
-    std::vector<std::shared_ptr<AsmOperand> > operands;
+    // the instruction, with its name, opcode and operand count
+    const AsmCode *code;
+    Origin origin;
+    std::vector<AsmOperand*> operands;
 };
 
 class LabelStmt : public AsmLine {
 public:
-    LabelStmt(const std::string &name)
-    : name(name) {
+    static const Kind nodeKind = Label;
+
+    LabelStmt(const Name &name)
+    : AsmLine(nodeKind), name(name) {
     }
     virtual ~LabelStmt() {
     }
-    virtual void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
-    virtual void accept(AsmWalker *walker) {
-        walker->visit(this);
-    }
 
     virtual int getSize() const {
         return 0;
     }
 
-    std::string name;
+    Name name;
 };
 
 
 class ReturnDef : public StatementDef {
 public:
+    static const Kind nodeKind = Return;
+
+    ReturnDef()
+    : StatementDef(nodeKind), retValue(nullptr)
+    { }
     virtual ~ReturnDef() {
     }
-    virtual void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
 
-    std::shared_ptr<ExpressionDef> retValue;
+    ExpressionDef *retValue;
 };
 
 class Value {
 public:
     enum Type {
-        Constant, Identifier, Local
+        // a String's text is its handle in the StringPool
+        Constant, Identifier, Local, String
     };
 
     Value()
@@ -183,54 +178,58 @@ public:
     Value(int value)
     : type(Constant),  value(value)
     { }
-    Value(const std::string &text)
+    Value(const Name &text)
     : type(Identifier),  text(text)
     { }
 
-    void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
-    void accept(AsmWalker *walker) {
-        walker->visit(this);
-    }
-
     Type type;
     int value;
-    std::string text;
+    Name text;
 };
 
 class ExpressionDef {
 public:
+    enum Kind : uint8_t {
+        NameRef, Literal, PrefixOp, InfixOp
+    };
+
+    ExpressionDef(Kind kind)
+    : kind(kind)
+    { }
     virtual ~ExpressionDef() {};
-    virtual void accept(ExpressionWalker *walker) = 0;
+
+    const Kind kind;
 };
 class NameExpression : public ExpressionDef {
 public:
-    virtual void accept(ExpressionWalker *walker) {
-        walker->visit(this);
-    }
-    std::string name;
+    NameExpression()
+    : ExpressionDef(NameRef)
+    { }
+    Name name;
     Value value;
 };
 class LiteralExpression : public ExpressionDef {
 public:
-    virtual void accept(ExpressionWalker *walker) {
-        walker->visit(this);
-    }
+    LiteralExpression()
+    : ExpressionDef(Literal)
+    { }
     int litValue;
 };
 class PrefixOpExpression : public ExpressionDef {
 public:
-    virtual void accept(ExpressionWalker *walker) {
-        walker->visit(this);
-    }
-    std::shared_ptr<ExpressionDef> right;
+    PrefixOpExpression()
+    : ExpressionDef(PrefixOp)
+    { }
+    ExpressionDef *right;
     int opType;
 };
 class InfixOpExpression : public ExpressionDef {
 public:
-    std::shared_ptr<ExpressionDef> left;
-    std::shared_ptr<ExpressionDef> right;
+    InfixOpExpression()
+    : ExpressionDef(InfixOp)
+    { }
+    ExpressionDef *left;
+    ExpressionDef *right;
     int opType;
 };
 
@@ -241,61 +240,135 @@ public:
         Constant, Local, RAM, Label, Function, String
     };
 
-    SymbolDef(const std::string &name, Type type)
-    : name(name), type(type), value(0) {
+    SymbolDef(const Name &name, Type type, const Origin &origin)
+    : name(name), type(type), value(0), origin(origin) {
     }
-    std::string name;
+
+    // makes a use of this symbol in function refer to it
+    void bind(Value &value, const FunctionDef *function) const;
+
+    Name name;
     Type type;
     int value;
+    // where it was declared
+    Origin origin;
 };
 
+/* The symbols declared in one scope. Scopes are chained through parent up
+ * to the global symbols, and a lookup tries each scope in turn. A scope
+ * with only a few symbols, as most are, is searched straight through its
+ * list; a bigger one also keeps an open addressing hash table keyed by the
+ * symbols' names, so each scope takes a single probe or a short scan. The
+ * symbols themselves belong to the arena they were made in.
+ */
 class SymbolTable {
 public:
     SymbolTable()
     : parent(nullptr) {
     }
-    ~SymbolTable() {
-        for (auto i : symbols) {
-            delete i.second;
-        }
-    }
 
-    SymbolDef* get(const std::string &name);
-    bool exists(const std::string &name) const;
+    SymbolDef* get(const Name &name);
+    // the symbol with this name in this scope alone
+    SymbolDef* find(const Name &name) const;
+    bool exists(const Name &name) const;
     void add(SymbolDef *name, bool functionScope = false);
+    // adds a symbol to this scope without looking for it in any other
+    void insert(SymbolDef *symbol);
+    void clear();
+    size_t size() const {
+        return declared.size();
+    }
 
     SymbolTable *parent;
-    std::map<std::string, SymbolDef*> symbols;
+    // symbols in the order they were declared
+    std::vector<SymbolDef*> declared;
+
+private:
+    void rehash(size_t capacity);
+
+    // empty until the scope gets too big to search through declared
+    std::vector<SymbolDef*> slots;
 };
 
 class CodeBlock : public StatementDef {
 public:
+    static const Kind nodeKind = Block;
+
     CodeBlock()
-    : origin("(unknown)", 0, 0)
+    : StatementDef(nodeKind)
     { }
     ~CodeBlock() {
     }
-    virtual void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
     SymbolTable locals;
-    std::vector<std::shared_ptr<StatementDef> > statements;
+    std::vector<StatementDef*> statements;
     Origin origin;
 };
 
 class FunctionDef {
 public:
     FunctionDef()
-    : localCount(0), origin("(unknown)", 0, 0)
+    : localCount(0), code(nullptr)
     { }
     ~FunctionDef() {
     }
-    void accept(AstWalker *walker) {
-        walker->visit(this);
-    }
     SymbolTable args;
-    std::string name;
+    Name name;
     int localCount;
-    std::shared_ptr<CodeBlock> code;
+    // the name each of the function's labels has outside it, indexed by
+    // the label's number
+    std::vector<Name> labels;
+    CodeBlock *code;
     Origin origin;
 };
+
+/* The base of the passes that walk the AST. A walker derives from
+ * AstWalker<itself> and has a visit method for each kind of node it is
+ * walked over. walk picks the method by the node's kind tag and calls it
+ * directly, so there is no virtual call and the compiler can inline the
+ * visit. Only the walk a walker actually uses has to have its visits.
+ */
+template<class Walker>
+class AstWalker {
+public:
+    void walk(StatementDef *stmt) {
+        Walker &walker = static_cast<Walker&>(*this);
+        switch (stmt->kind) {
+            case StatementDef::Expression:
+                walker.visit(static_cast<ExpressionStmt*>(stmt));
+                break;
+            case StatementDef::Block:
+                walker.visit(static_cast<CodeBlock*>(stmt));
+                break;
+            case StatementDef::Return:
+                walker.visit(static_cast<ReturnDef*>(stmt));
+                break;
+            case StatementDef::Data:
+                walker.visit(static_cast<AsmData*>(stmt));
+                break;
+            case StatementDef::Instruction:
+                walker.visit(static_cast<AsmStatement*>(stmt));
+                break;
+            case StatementDef::Label:
+                walker.visit(static_cast<LabelStmt*>(stmt));
+                break;
+        }
+    }
+
+    void walk(ExpressionDef *expr) {
+        Walker &walker = static_cast<Walker&>(*this);
+        switch (expr->kind) {
+            case ExpressionDef::NameRef:
+                walker.visit(static_cast<NameExpression*>(expr));
+                break;
+            case ExpressionDef::Literal:
+                walker.visit(static_cast<LiteralExpression*>(expr));
+                break;
+            case ExpressionDef::PrefixOp:
+                walker.visit(static_cast<PrefixOpExpression*>(expr));
+                break;
+            case ExpressionDef::InfixOp:
+                assert(!"the parser does not make infix expressions yet");
+                break;
+        }
+    }
+};
@@ -1,38 +1,37 @@
 #include <iostream>
 #include <vector>
 
-#include <utf8.h>
-
 #include "gbuilder.h"
+#include "parallel.h"
 
-class BuildExpr : public ExpressionWalker {
+class BuildExpr : public AstWalker<BuildExpr> {
 public:
-    BuildExpr(std::vector<std::shared_ptr<AsmLine> > &stmts, GameData &gamedata)
-    : stmts(stmts), gamedata(gamedata)
+    BuildExpr(std::vector<AsmLine*> &stmts, Arena &arena)
+    : stmts(stmts), arena(arena)
     { }
 
     void visit(NameExpression *expr) {
-        std::shared_ptr<AsmStatement> opCopy(new AsmStatement());
-        opCopy->opname = "copy";
-        opCopy->opcode = 0x40;
+        AsmStatement *opCopy = arena.make<AsmStatement>();
+        opCopy->code = &opcodeByName("copy");
 
-        std::shared_ptr<AsmOperand> litValue;
+        AsmOperand *litValue = nullptr;
         switch(expr->value.type) {
             case Value::Constant:
-                litValue.reset(new AsmOperand());
-                litValue->value = std::shared_ptr<Value>(new Value(expr->value.value));
+                litValue = arena.make<AsmOperand>();
+                litValue->value = arena.make<Value>(expr->value.value);
                 opCopy->operands.push_back(litValue);
                 break;
             case Value::Local:
-                litValue.reset(new AsmOperand());
-                litValue->value = std::shared_ptr<Value>(new Value(expr->value));
+            case Value::String:
+                litValue = arena.make<AsmOperand>();
+                litValue->value = arena.make<Value>(expr->value);
                 opCopy->operands.push_back(litValue);
                 break;
             case Value::Identifier:
                 break;
         }
 
-        std::shared_ptr<AsmOperand> destPos(new AsmOperand());
+        AsmOperand *destPos = arena.make<AsmOperand>();
         destPos->isStack = true;
         opCopy->operands.push_back(destPos);
 
@@ -40,15 +39,14 @@ public:
     }
 
     void visit(LiteralExpression *expr) {
-        std::shared_ptr<AsmStatement> opCopy(new AsmStatement());
-        opCopy->opname = "copy";
-        opCopy->opcode = 0x40;
+        AsmStatement *opCopy = arena.make<AsmStatement>();
+        opCopy->code = &opcodeByName("copy");
 
-        std::shared_ptr<AsmOperand> litValue(new AsmOperand());
-        litValue->value = std::shared_ptr<Value>(new Value(expr->litValue));
+        AsmOperand *litValue = arena.make<AsmOperand>();
+        litValue->value = arena.make<Value>(expr->litValue);
         opCopy->operands.push_back(litValue);
 
-        std::shared_ptr<AsmOperand> destPos(new AsmOperand());
+        AsmOperand *destPos = arena.make<AsmOperand>();
         destPos->isStack = true;
         opCopy->operands.push_back(destPos);
 
@@ -59,35 +57,31 @@ public:
 
     }
 
-    std::vector<std::shared_ptr<AsmLine> > &stmts;
+    std::vector<AsmLine*> &stmts;
 private:
-    GameData &gamedata;
+    Arena &arena;
 };
 
-class BuildAsm : public AstWalker {
+class BuildAsm : public AstWalker<BuildAsm> {
 public:
-    BuildAsm(GameData &gamedata)
-    : gamedata(gamedata) { }
+    BuildAsm(Arena &arena)
+    : arena(arena) { }
 
-    virtual void visit(Value *stmt) {
-    }
-    virtual void visit(AsmStatement *stmt) {
-        std::shared_ptr<AsmStatement> stmtCopy(new AsmStatement(*stmt));
-        stmts.push_back(stmtCopy);
+    void visit(AsmStatement *stmt) {
+        stmts.push_back(stmt);
     }
-    virtual void visit(AsmData *stmt) {
-        std::shared_ptr<AsmData> stmtCopy(new AsmData(*stmt));
-        stmts.push_back(stmtCopy);
+    void visit(AsmData *stmt) {
+        stmts.push_back(stmt);
     }
-    virtual void visit(CodeBlock *stmt) {
+    void visit(CodeBlock *stmt) {
         for (auto s : stmt->statements) {
-            s->accept(this);
+            walk(s);
         }
     }
-    virtual void visit(FunctionDef *stmt) {
-        std::shared_ptr<LabelStmt> funcLabel(new LabelStmt(stmt->name));
+    void visit(FunctionDef *stmt) {
+        LabelStmt *funcLabel = arena.make<LabelStmt>(stmt->name);
         stmts.push_back(funcLabel);
-        std::shared_ptr<AsmData> funcHeader(new AsmData());
+        AsmData *funcHeader = arena.make<AsmData>();
         funcHeader->data.push_back(0xC1);
         int locals = stmt->localCount;
         while (locals >= 255) {
@@ -104,98 +98,71 @@ public:
         funcHeader->data.push_back(0);
         stmts.push_back(funcHeader);
         if (stmt->code) {
-            stmt->code->accept(this);
+            visit(stmt->code);
         }
     }
-    virtual void visit(ReturnDef *stmt) {
-        BuildExpr bExpr(stmts, gamedata);
-        stmt->retValue->accept(&bExpr);
-
-        std::shared_ptr<AsmStatement> retStmt(new AsmStatement());
-        retStmt->opname = "return";
-        retStmt->opcode = 0x31;
-        std::shared_ptr<AsmOperand> retCode(new AsmOperand());
-        // retCode->value = std::shared_ptr<Value>(new Value(0));
+    void visit(ReturnDef *stmt) {
+        BuildExpr bExpr(stmts, arena);
+        bExpr.walk(stmt->retValue);
+
+        AsmStatement *retStmt = arena.make<AsmStatement>();
+        retStmt->code = &opcodeByName("return");
+        AsmOperand *retCode = arena.make<AsmOperand>();
         retCode->isStack = true;
         retStmt->operands.push_back(retCode);
         stmts.push_back(retStmt);
     }
-    virtual void visit(ExpressionStmt *stmt) {
-        BuildExpr bExpr(stmts, gamedata);
-        stmt->expr->accept(&bExpr);
+    void visit(ExpressionStmt *stmt) {
+        BuildExpr bExpr(stmts, arena);
+        bExpr.walk(stmt->expr);
 
-        std::shared_ptr<AsmStatement> retStmt(new AsmStatement());
-        retStmt->opname = "copy";
-        retStmt->opcode = 0x40;
+        AsmStatement *retStmt = arena.make<AsmStatement>();
+        retStmt->code = &opcodeByName("copy");
 
-        std::shared_ptr<AsmOperand> retCode(new AsmOperand());
+        AsmOperand *retCode = arena.make<AsmOperand>();
         retCode->isStack = true;
         retStmt->operands.push_back(retCode);
 
-        std::shared_ptr<AsmOperand> op2(new AsmOperand());
-        op2->value = std::shared_ptr<Value>(new Value(0));
+        AsmOperand *op2 = arena.make<AsmOperand>();
+        op2->value = arena.make<Value>(0);
         retStmt->operands.push_back(op2);
 
         stmts.push_back(retStmt);
     }
-    virtual void visit(LabelStmt *stmt) {
-        std::shared_ptr<LabelStmt> stmtCopy(new LabelStmt(*stmt));
-        stmts.push_back(stmtCopy);
+    void visit(LabelStmt *stmt) {
+        stmts.push_back(stmt);
     }
 
-    void buildStrings() {
-        for (const auto &strdef : gamedata.stringtable) {
-            std::shared_ptr<LabelStmt> strLabel(new LabelStmt(strdef.first));
-            stmts.push_back(strLabel);
-
-            bool isUnicode = false;
-            for (unsigned char c : strdef.second) {
-                if (c > 127) {
-                    isUnicode = true;
-                }
-            }
-
-            std::shared_ptr<AsmData> strData(new AsmData);
-            if (isUnicode) {
-                strData->data.push_back(0xE2);
-                strData->data.push_back(0);
-                strData->data.push_back(0);
-                strData->data.push_back(0);
-                std::string::const_iterator cur = strdef.second.cbegin();
-                while (cur != strdef.second.end()) {
-                    int cp = utf8::next(cur, strdef.second.cend());
-                    strData->pushWord(cp);
-                }
-                strData->pushWord(0);
-            } else {
-                strData->data.push_back(0xE0);
-                for (char c : strdef.second) {
-                    strData->data.push_back(c);
-                }
-                strData->data.push_back(0);
-            }
-
-            stmts.push_back(strData);
-        }
-    }
-
-    std::vector<std::shared_ptr<AsmLine> > stmts;
+    std::vector<AsmLine*> stmts;
 private:
-    GameData &gamedata;
+    Arena &arena;
 };
 
 
-
-std::vector<std::shared_ptr<AsmLine> > buildAsm(GameData &gd) {
-
-    BuildAsm buildAsmWalker(gd);
-
-    buildAsmWalker.buildStrings();
-
-    for (auto f : gd.functions) {
-        f->accept(&buildAsmWalker);
+/* Lowers each function on its own, using up to jobs threads. Every thread
+ * makes its nodes in an arena of its own, and the lines of each function
+ * are kept apart until they are joined in program order.
+ */
+std::vector<AsmLine*> buildAsm(GameData &gd, int jobs) {
+    std::vector<std::vector<AsmLine*> > functionLines(gd.functions.size());
+    std::vector<Arena> arenas(workerCount(gd.functions.size(), jobs));
+    forEachIndex(gd.functions.size(), jobs, [&gd, &functionLines, &arenas](size_t i, unsigned worker) {
+        BuildAsm buildAsmWalker(arenas[worker]);
+        buildAsmWalker.visit(gd.functions[i]);
+        functionLines[i].swap(buildAsmWalker.stmts);
+    });
+    for (Arena &arena : arenas) {
+        gd.arena.adopt(arena);
     }
 
-    return buildAsmWalker.stmts;
+    size_t total = 0;
+    for (const std::vector<AsmLine*> &lines : functionLines) {
+        total += lines.size();
+    }
+    std::vector<AsmLine*> stmts;
+    stmts.reserve(total);
+    for (const std::vector<AsmLine*> &lines : functionLines) {
+        stmts.insert(stmts.end(), lines.begin(), lines.end());
+    }
+    return stmts;
 }
-
@@ -1,105 +1,214 @@
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <unordered_map>
 
 #include "gbuilder.h"
+#include "flatcode.h"
+#include "encode.h"
 
-static void writeByte(std::ostream &out, int word) {
-    out.put((word      ) & 0xFF);
-}
-
-static void writeShort(std::ostream &out, int word) {
-    out.put((word >>  8) & 0xFF);
-    out.put((word      ) & 0xFF);
-}
-
-static void writeWord(std::ostream &out, int word) {
-    out.put((word >> 24) & 0xFF);
-    out.put((word >> 16) & 0xFF);
-    out.put((word >>  8) & 0xFF);
-    out.put((word      ) & 0xFF);
-}
-
-static int readWord(std::istream &in) {
-    int result = 0;
-    result |= in.get() << 24;
-    result |= in.get() << 16;
-    result |= in.get() << 8;
-    result |= in.get();
-    return result;
-}
-
-class GlulxGame : public AsmWalker {
+/* The game file as it is being built. The whole image is held in memory
+ * and written out in one go at the end. As each byte goes in it is added to
+ * the checksum (the sum of the file taken as big-endian words), and bytes
+ * that are skipped over are left as zeros, which the sum can ignore.
+ */
+class ImageBuffer {
 public:
-    virtual void visit(Value *stmt) {
+    ImageBuffer()
+    : pos(0), sum(0)
+    { }
+
+    // sets aside room for the whole image once its size is known
+    void allocate(size_t size) {
+        data.resize(size, 0);
     }
-    virtual void visit(AsmStatement *stmt) {
-        if (stmt->opcode > 0x3FFF) {
-            writeWord(out, stmt->opcode + 0xC0000000);
-        } else if (stmt->opcode > 0x7F) {
-            writeShort(out, stmt->opcode + 0x8000);
+
+    void put(unsigned char c) {
+        sum += static_cast<uint32_t>(c) << ((3 - (pos & 3)) * 8);
+        if (pos < data.size()) {
+            data[pos] = c;
         } else {
-            writeByte(out, stmt->opcode);
+            data.push_back(c);
         }
-
-        int curMode = -1;
-        for (auto op : stmt->operands) {
-            int mode = op->getMode();
-            if (curMode < 0) {
-                curMode = mode;
-            } else {
-//                curMode <<= 4;
-                curMode |= (mode << 4);
-                writeByte(out, curMode);
-                curMode = -1;
-            }
+        ++pos;
+    }
+    void skipTo(size_t newPos) {
+        if (newPos > data.size()) {
+            data.resize(newPos, 0);
         }
-        if (curMode >= 0) {
-            writeByte(out, curMode);
+        if (newPos > pos) {
+            pos = newPos;
         }
+    }
+    size_t tell() const {
+        return pos;
+    }
 
-        for (int i = 0; i < stmt->operands.size(); ++i) {
-            std::shared_ptr<AsmOperand> op = stmt->operands[i];
-            if (op->isStack) continue;
-            int value = op->value->value;
-            if (op->value->type == Value::Identifier) {
-                value = labels[op->value->text];
-            }
-            if (stmt->isRelative && i == stmt->operands.size() - 1) {
-                value = value - (stmt->pos + stmt->getSize()) + 2;
-            }
-
-            switch(op->getSize()) {
-                case 1: writeByte(out, value);  break;
-                case 2: writeShort(out, value); break;
-                case 4: writeWord(out, value);  break;
-            }
-        }
+    // stores a word without counting it in the checksum
+    void patchWord(size_t at, uint32_t word) {
+        data[at    ] = (word >> 24) & 0xFF;
+        data[at + 1] = (word >> 16) & 0xFF;
+        data[at + 2] = (word >>  8) & 0xFF;
+        data[at + 3] = (word      ) & 0xFF;
     }
-    virtual void visit(AsmData *data) {
-        for (unsigned char c : data->data) {
-            out.put(c);
-        }
+
+    uint32_t checksum() const {
+        return sum;
     }
-    virtual void visit(LabelStmt *label) {
-        // do nothing
+    const std::vector<unsigned char>& bytes() const {
+        return data;
     }
 
-    GlulxGame(std::ostream &out, std::vector<std::shared_ptr<AsmLine> > &lines)
-    : lines(lines), out(out)
+private:
+    std::vector<unsigned char> data;
+    size_t pos;
+    uint32_t sum;
+};
+
+static void writeWord(ImageBuffer &out, int word) {
+    encodeBytes(out, word, 4);
+}
+
+class GlulxGame {
+public:
+    GlulxGame(ImageBuffer &out, const FlatCode &code)
+    : code(code), out(out)
     { }
 
+    void write() {
+        for (const FlatLine &line : code.lines) {
+            switch (line.kind) {
+                case FlatLine::Instruction:
+                    encodeInstruction(out, *line.code, &code.operands[line.first], line.count,
+                                      &code.labelAddresses, line.pos + line.size);
+                    break;
+                case FlatLine::Data:
+                    for (uint32_t i = 0; i < line.count; ++i) {
+                        out.put(code.bytes[line.first + i]);
+                    }
+                    break;
+                case FlatLine::Label:
+                    break;
+            }
+        }
+    }
+
+    // the address of a label, or 0 if there is no such label
+    int addressOf(const char *name) const {
+        int id = code.findLabel(Name(name));
+        return id < 0 ? 0 : std::max(code.labelAddresses[id], 0);
+    }
+
     int firstRam;
     int endOfRam;
     int endOfExtended;
     int stackSize;
-    std::unordered_map<std::string, int> labels;
-    std::vector<std::shared_ptr<AsmLine> > &lines;
-    std::ostream &out;
+    const FlatCode &code;
+    ImageBuffer &out;
+};
 
+
+
+/* ************************************************************ *
+ * LAYOUT                                                       *
+ * ************************************************************ */
+
+// the smallest operand that holds value as a sign-extended constant
+static int constantSize(int value) {
+    if (value >= -128 && value <= 127) {
+        return 1;
+    } else if (value >= -32768 && value <= 32767) {
+        return 2;
+    }
+    return 4;
+}
+
+/* An operand that refers to a label, whose size depends on where the label
+ * ends up. A branch's offset is relative to the end of the instruction;
+ * other references hold the address itself, which is unsigned when it is
+ * used as a memory address and sign-extended otherwise.
+ */
+class LabelReference {
+public:
+    unsigned line;
+    unsigned operand;
+    bool isBranch;
+
+    int neededSize(const FlatCode &code) const {
+        const FlatLine &stmt = code.lines[line];
+        const FlatOperand &op = code.operands[operand];
+        int address = std::max(code.labelAddresses[op.value], 0);
+        if (isBranch) {
+            return constantSize(address - (stmt.pos + stmt.size) + 2);
+        } else if (op.isIndirect) {
+            return address <= 0xFF ? 1 : (address <= 0xFFFF ? 2 : 4);
+        }
+        return constantSize(address);
+    }
 };
 
+static int placeLines(FlatCode &code) {
+    int pos = firstLineAddress;
+    for (FlatLine &line : code.lines) {
+        line.pos = pos;
+        if (line.kind == FlatLine::Label) {
+            code.labelAddresses[line.first] = pos;
+        }
+        pos += line.size;
+    }
+    return pos;
+}
+
+/* Gives every label reference the smallest operand that reaches its
+ * target. All references start out at one byte and the lines are placed;
+ * any reference that cannot reach its target is widened and the lines are
+ * placed again, until nothing changes. Operands only ever grow, so this
+ * always finishes, and no reference is left narrower than it needs to be.
+ */
+static void relaxLabelReferences(FlatCode &code) {
+    std::vector<LabelReference> references;
+    std::vector<unsigned> referencing;
+    for (unsigned i = 0; i < code.lines.size(); ++i) {
+        FlatLine &line = code.lines[i];
+        if (line.kind != FlatLine::Instruction) {
+            continue;
+        }
+        bool refers = false;
+        for (unsigned j = 0; j < line.count; ++j) {
+            FlatOperand &op = code.operands[line.first + j];
+            if (op.kind != FlatOperand::Label) {
+                continue;
+            }
+            LabelReference reference;
+            reference.line = i;
+            reference.operand = line.first + j;
+            reference.isBranch = line.code->relative && j == line.count - 1;
+            references.push_back(reference);
+            op.size = 1;
+            refers = true;
+        }
+        if (refers) {
+            line.size = code.measure(line);
+            referencing.push_back(i);
+        }
+    }
+
+    bool grew = true;
+    while (grew) {
+        placeLines(code);
+        grew = false;
+        for (const LabelReference &reference : references) {
+            int size = reference.neededSize(code);
+            if (size > code.operands[reference.operand].size) {
+                code.operands[reference.operand].size = size;
+                grew = true;
+            }
+        }
+        for (unsigned line : referencing) {
+            code.lines[line].size = code.measure(code.lines[line]);
+        }
+    }
+}
 
 
 /*
@@ -113,20 +222,15 @@ public:
 28 | Decoding Tbl  | (4 bytes)
 32 | Checksum      | (4 bytes)
 */
-static void writeHeader(GlulxGame &glulx, std::ostream &out) {
+static void writeHeader(GlulxGame &glulx, ImageBuffer &out) {
     writeWord(out, 0x476C756C); // magic number
     writeWord(out, 0x00030102); // glulx version
     writeWord(out, glulx.firstRam); // ramstart
     writeWord(out, glulx.endOfRam); // extstart
     writeWord(out, glulx.endOfExtended); // endmem
     writeWord(out, glulx.stackSize); // stack size
-    if (glulx.labels.count("main") > 0) {
-         // start func
-        writeWord(out, glulx.labels["main"]);
-    } else {
-        writeWord(out, 0x00000000);
-    }
-    writeWord(out, 0x00000000); // decoding table
+    writeWord(out, glulx.addressOf("main")); // start func
+    writeWord(out, glulx.addressOf("decoding.table")); // decoding table
     writeWord(out, 0x00000000); // checksum
 
 
@@ -134,58 +238,60 @@ static void writeHeader(GlulxGame &glulx, std::ostream &out) {
     writeWord(out, 0x00010000); // gbuilder version
 
     // pad out header
-    while (out.tellp() % 256) {
-        out.put(0);
-    }
+    out.skipTo((out.tell() + 255) / 256 * 256);
 }
 
-void build_game(GameData &gamedata, std::vector<std::shared_ptr<AsmLine> > lines, const ProjectFile *projectFile, bool dumpLabels) {
-    std::fstream out(projectFile->outputFile, std::ios_base::in | std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
-    GlulxGame gameBuilder(out, lines);
-    int lastpos = 256;
+bool build_game(GameData &gamedata, FlatCode &code, const ProjectFile *projectFile, bool dumpLabels,
+                std::ostream &status) {
+    ImageBuffer out;
+    GlulxGame gameBuilder(out, code);
 
-    for (auto line : lines) {
-        line->pos = lastpos;
-        std::shared_ptr<LabelStmt> label = std::dynamic_pointer_cast<LabelStmt>(line);
-        if (label) {
-            gameBuilder.labels[label->name] = label->pos;
-        }
-        lastpos += line->getSize();
-    }
+    relaxLabelReferences(code);
+    int lastpos = placeLines(code);
     while (lastpos % 256) {
         ++lastpos;
     }
 
+    out.allocate(lastpos);
     gameBuilder.stackSize = 2048;
-    gameBuilder.firstRam = 256;
+    gameBuilder.firstRam = firstLineAddress;
     gameBuilder.endOfRam = lastpos;
     gameBuilder.endOfExtended = lastpos;
 
 
     if (dumpLabels) {
-        std::cout << std::hex << std::setfill('0');
-        for (auto i : gameBuilder.labels) {
-            std::cout << std::setw(8) << i.second << ": " << i.first << '\n';
+        // list labels by address so the listing does not depend on the
+        // order names happened to be interned in
+        std::vector<std::pair<int, std::string> > sorted;
+        for (unsigned i = 0; i < code.labelNames.size(); ++i) {
+            if (code.labelAddresses[i] >= 0) {
+                sorted.push_back({code.labelAddresses[i], code.labelNames[i].str()});
+            }
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        status << std::hex << std::setfill('0');
+        for (auto i : sorted) {
+            status << std::setw(8) << i.first << ": " << i.second << '\n';
         }
-        std::cout << std::dec << std::setfill(' ');
+        status << std::dec << std::setfill(' ');
     }
 
     writeHeader(gameBuilder, out);
-    for (auto line : lines) {
-        line->accept(&gameBuilder);
-    }
+    gameBuilder.write();
 
-    for (int i = out.tellp(); i < gameBuilder.endOfRam; ++i) {
-        out.put(0);
-    }
+    out.skipTo(gameBuilder.endOfRam);
+    out.patchWord(32, out.checksum());
 
-    out.seekg(0);
-    unsigned checksum = 0, next = 0;
-    do {
-        checksum += next;
-        next = readWord(out);
-    } while (out.good());
-    out.clear();
-    out.seekp(32);
-    writeWord(out, checksum);
+    // "-" sends the game file to standard output
+    const std::vector<unsigned char> &image = out.bytes();
+    if (projectFile->outputFile == "-") {
+        std::cout.write(reinterpret_cast<const char*>(image.data()), image.size());
+        std::cout.flush();
+        return std::cout.good();
+    }
+    std::ofstream file(projectFile->outputFile, std::ios_base::binary | std::ios_base::trunc);
+    file.write(reinterpret_cast<const char*>(image.data()), image.size());
+    file.close();
+    return file.good();
 }
@@ -0,0 +1,598 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "gbuilder.h"
+
+// Part of every entry's key. This must be changed whenever the lexer or
+// parser start producing something different from the same source, or when
+// the layout of an entry changes, so that older entries stop being used.
+static const char *compilerVersion = "gbuilder 1.0.0 front end 8";
+
+static const char entryMagic[8] = { 'G', 'B', 'C', 'A', 'C', 'H', 'E', 0 };
+
+// tags for the statements and expressions in an entry
+enum EntryTag {
+    TagNone,
+    TagCodeBlock,
+    TagExpressionStmt,
+    TagReturn,
+    TagLabel,
+    TagAsmStatement,
+    TagAsmData,
+    TagNameExpr,
+    TagLiteralExpr,
+    TagPrefixOpExpr
+};
+
+static uint64_t hashBytes(uint64_t hash, const char *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+
+/* ************************************************************ *
+ * WRITING ENTRIES                                              *
+ * ************************************************************ */
+
+/* Builds an entry in memory. Names are written as indexes into a table of
+ * spellings that goes at the front of the entry, so each spelling is stored
+ * (and later interned) only once per entry.
+ */
+class EntryWriter : public AstWalker<EntryWriter> {
+public:
+    void byte(unsigned value) {
+        body.push_back(static_cast<char>(value));
+    }
+    void word(uint32_t value) {
+        body.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void number(double value) {
+        body.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void text(const std::string &value) {
+        word(value.size());
+        body.append(value);
+    }
+    void name(const Name &value) {
+        auto known = nameIndex.find(value);
+        if (known != nameIndex.end()) {
+            word(known->second);
+            return;
+        }
+        uint32_t index = names.size();
+        nameIndex.insert({value, index});
+        names.push_back(value);
+        word(index);
+    }
+    void origin(const Origin &value) {
+        word(value.offset);
+    }
+
+    void symbols(const SymbolTable &table) {
+        word(table.declared.size());
+        for (const SymbolDef *symbol : table.declared) {
+            name(symbol->name);
+            byte(symbol->type);
+            word(symbol->value);
+            origin(symbol->origin);
+        }
+    }
+
+    void expression(ExpressionDef *expr) {
+        if (expr) {
+            walk(expr);
+        } else {
+            byte(TagNone);
+        }
+    }
+
+    void visit(Value *value) {
+        byte(value->type);
+        word(value->value);
+        name(value->text);
+        auto use = unresolved.find(value);
+        byte(use != unresolved.end());
+        if (use != unresolved.end()) {
+            origin(use->second);
+        }
+    }
+    void visit(AsmStatement *stmt) {
+        byte(TagAsmStatement);
+        origin(stmt->origin);
+        text(stmt->code->name);
+        word(stmt->operands.size());
+        for (AsmOperand *op : stmt->operands) {
+            byte(op->isStack | op->isIndirect << 1 | (op->value != nullptr) << 2);
+            word(op->mySize);
+            if (op->value) {
+                visit(op->value);
+            }
+        }
+    }
+    void visit(ExpressionStmt *stmt) {
+        byte(TagExpressionStmt);
+        expression(stmt->expr);
+    }
+    void visit(AsmData *stmt) {
+        byte(TagAsmData);
+        word(stmt->data.size());
+        body.append(stmt->data.begin(), stmt->data.end());
+    }
+    void visit(CodeBlock *stmt) {
+        byte(TagCodeBlock);
+        origin(stmt->origin);
+        symbols(stmt->locals);
+        word(stmt->statements.size());
+        for (StatementDef *child : stmt->statements) {
+            walk(child);
+        }
+    }
+    void visit(FunctionDef *stmt) {
+        name(stmt->name);
+        origin(stmt->origin);
+        word(stmt->localCount);
+        symbols(stmt->args);
+        visit(stmt->code);
+    }
+    void visit(ReturnDef *stmt) {
+        byte(TagReturn);
+        expression(stmt->retValue);
+    }
+    void visit(LabelStmt *stmt) {
+        byte(TagLabel);
+        name(stmt->name);
+    }
+
+    void visit(NameExpression *expr) {
+        byte(TagNameExpr);
+        name(expr->name);
+        visit(&expr->value);
+    }
+    void visit(LiteralExpression *expr) {
+        byte(TagLiteralExpr);
+        word(expr->litValue);
+    }
+    void visit(PrefixOpExpression *expr) {
+        byte(TagPrefixOpExpr);
+        word(expr->opType);
+        expression(expr->right);
+    }
+
+    // the finished entry: the header, the table of names and then the body
+    std::string finish(uint32_t sourceSize) {
+        EntryWriter head;
+        head.body.append(entryMagic, sizeof(entryMagic));
+        head.text(compilerVersion);
+        head.word(sourceSize);
+        head.word(names.size());
+        for (const Name &name : names) {
+            head.text(name.str());
+        }
+        return head.body + body;
+    }
+
+    // the values holding names left for after the files are merged
+    std::unordered_map<const Value*, Origin> unresolved;
+
+private:
+    std::string body;
+    std::vector<Name> names;
+    std::unordered_map<Name, uint32_t> nameIndex;
+};
+
+
+/* ************************************************************ *
+ * READING ENTRIES                                              *
+ * ************************************************************ */
+
+/* Rebuilds a SourceUnit from an entry. Every read is checked against the
+ * end of the entry; once anything is out of place the reader is marked as
+ * failed and only hands back zeros, and the caller throws the unit away.
+ */
+class EntryReader {
+public:
+    EntryReader(SourceView data, SourceUnit &unit)
+    : data(data), pos(0), failed(false), unit(unit), arena(unit.gamedata.arena) {
+    }
+
+    bool ok() const {
+        return !failed;
+    }
+    bool fail() {
+        failed = true;
+        return false;
+    }
+
+    unsigned byte() {
+        if (failed || pos + 1 > data.size()) {
+            fail();
+            return 0;
+        }
+        return static_cast<unsigned char>(data[pos++]);
+    }
+    uint32_t word() {
+        uint32_t value = 0;
+        if (failed || pos + sizeof(value) > data.size()) {
+            fail();
+            return 0;
+        }
+        memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+    double number() {
+        double value = 0.0;
+        if (failed || pos + sizeof(value) > data.size()) {
+            fail();
+            return 0.0;
+        }
+        memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+    std::string text() {
+        uint32_t size = word();
+        if (failed || size > data.size() - pos) {
+            fail();
+            return std::string();
+        }
+        pos += size;
+        return data.substr(pos - size, size);
+    }
+    Name name() {
+        uint32_t index = word();
+        if (index >= names.size()) {
+            fail();
+            return Name();
+        }
+        return names[index];
+    }
+    Origin origin() {
+        return Origin(unit.fileId, word());
+    }
+    // reads an item count, which can never be more than the bytes left
+    uint32_t count() {
+        uint32_t value = word();
+        if (value > data.size() - pos) {
+            fail();
+            return 0;
+        }
+        return value;
+    }
+
+    bool header(uint32_t sourceSize) {
+        if (data.size() < sizeof(entryMagic)
+                || memcmp(data.data(), entryMagic, sizeof(entryMagic)) != 0) {
+            return fail();
+        }
+        pos = sizeof(entryMagic);
+        if (text() != compilerVersion || word() != sourceSize) {
+            return fail();
+        }
+        uint32_t nameCount = count();
+        names.reserve(nameCount);
+        for (uint32_t i = 0; i < nameCount && !failed; ++i) {
+            uint32_t size = word();
+            if (failed || size > data.size() - pos) {
+                return fail();
+            }
+            names.push_back(Name(data.data() + pos, size));
+            pos += size;
+        }
+        return ok();
+    }
+
+    void tokens() {
+        uint32_t tokenCount = count();
+        unit.tokens.resize(tokenCount);
+        for (Token &token : unit.tokens) {
+            token.type = static_cast<TokenType>(byte());
+            token.vText = name();
+            token.vInteger = word();
+            token.vFloat = number();
+            token.opType = static_cast<OperatorType>(byte());
+            token.origin = origin();
+        }
+    }
+
+    // global symbols and strings, then the functions that use them
+    void globals() {
+        GameData &gamedata = unit.gamedata;
+        uint32_t symbolCount = count();
+        for (uint32_t i = 0; i < symbolCount && !failed; ++i) {
+            uint32_t index = word();
+            if (index >= names.size()) {
+                fail();
+                return;
+            }
+            SymbolDef::Type type = static_cast<SymbolDef::Type>(byte());
+            int value = word();
+            SymbolDef *symbol = arena.make<SymbolDef>(names[index], type, origin());
+            symbol->value = value;
+            gamedata.symbols.add(symbol);
+        }
+
+        uint32_t stringCount = count();
+        for (uint32_t i = 0; i < stringCount && !failed; ++i) {
+            gamedata.strings.add(name());
+        }
+
+        uint32_t functionCount = count();
+        for (uint32_t i = 0; i < functionCount && !failed; ++i) {
+            FunctionDef *function = arena.make<FunctionDef>();
+            function->name = name();
+            function->origin = origin();
+            function->localCount = word();
+            function->args.parent = &gamedata.symbols;
+            symbols(function->args);
+            if (byte() != TagCodeBlock) {
+                fail();
+                return;
+            }
+            function->code = codeBlock(&function->args);
+            gamedata.functions.push_back(function);
+        }
+
+        uint32_t vocabCount = count();
+        for (uint32_t i = 0; i < vocabCount && !failed; ++i) {
+            gamedata.vocabRaw.insert(text());
+        }
+    }
+
+    // symbols are put straight into the table, as they were already checked
+    // for clashes when the file was first parsed
+    void symbols(SymbolTable &table) {
+        uint32_t symbolCount = count();
+        for (uint32_t i = 0; i < symbolCount && !failed; ++i) {
+            Name symbolName = name();
+            SymbolDef::Type type = static_cast<SymbolDef::Type>(byte());
+            int value = word();
+            SymbolDef *symbol = arena.make<SymbolDef>(symbolName, type, origin());
+            symbol->value = value;
+            table.insert(symbol);
+        }
+    }
+
+    CodeBlock* codeBlock(SymbolTable *parent) {
+        CodeBlock *code = arena.make<CodeBlock>();
+        code->origin = origin();
+        code->locals.parent = parent;
+        symbols(code->locals);
+        uint32_t statementCount = count();
+        for (uint32_t i = 0; i < statementCount && !failed; ++i) {
+            StatementDef *stmt = statement(&code->locals);
+            if (stmt) {
+                code->statements.push_back(stmt);
+            }
+        }
+        return code;
+    }
+
+    StatementDef* statement(SymbolTable *scope) {
+        switch (byte()) {
+            case TagCodeBlock:
+                return codeBlock(scope);
+            case TagExpressionStmt: {
+                ExpressionStmt *stmt = arena.make<ExpressionStmt>();
+                stmt->expr = expression();
+                return stmt;
+            }
+            case TagReturn: {
+                ReturnDef *stmt = arena.make<ReturnDef>();
+                stmt->retValue = expression();
+                return stmt;
+            }
+            case TagLabel:
+                return arena.make<LabelStmt>(name());
+            case TagAsmStatement:
+                return asmStatement();
+            case TagAsmData: {
+                AsmData *stmt = arena.make<AsmData>();
+                std::string bytes = text();
+                stmt->data.assign(bytes.begin(), bytes.end());
+                return stmt;
+            }
+            default:
+                fail();
+                return nullptr;
+        }
+    }
+
+    AsmStatement* asmStatement() {
+        AsmStatement *stmt = arena.make<AsmStatement>();
+        stmt->origin = origin();
+        const AsmCode &code = opcodeByName(text());
+        if (code.name == nullptr) {
+            fail();
+            return stmt;
+        }
+        stmt->code = &code;
+        uint32_t operandCount = count();
+        for (uint32_t i = 0; i < operandCount && !failed; ++i) {
+            AsmOperand *op = arena.make<AsmOperand>();
+            unsigned flags = byte();
+            op->isStack = flags & 1;
+            op->isIndirect = flags & 2;
+            op->mySize = word();
+            if (flags & 4) {
+                op->value = arena.make<Value>();
+                value(*op->value);
+            }
+            stmt->operands.push_back(op);
+        }
+        return stmt;
+    }
+
+    void value(Value &value) {
+        value.type = static_cast<Value::Type>(byte());
+        value.value = word();
+        value.text = name();
+        if (byte()) {
+            unit.gamedata.unresolved.push_back(NameUse(&value, origin()));
+        }
+    }
+
+    ExpressionDef* expression() {
+        switch (byte()) {
+            case TagNone:
+                return nullptr;
+            case TagNameExpr: {
+                NameExpression *expr = arena.make<NameExpression>();
+                expr->name = name();
+                value(expr->value);
+                return expr;
+            }
+            case TagLiteralExpr: {
+                LiteralExpression *expr = arena.make<LiteralExpression>();
+                expr->litValue = word();
+                return expr;
+            }
+            case TagPrefixOpExpr: {
+                PrefixOpExpression *expr = arena.make<PrefixOpExpression>();
+                expr->opType = word();
+                expr->right = expression();
+                return expr;
+            }
+            default:
+                fail();
+                return nullptr;
+        }
+    }
+
+    bool atEnd() const {
+        return pos == data.size();
+    }
+
+private:
+    SourceView data;
+    size_t pos;
+    bool failed;
+    SourceUnit &unit;
+    Arena &arena;
+    std::vector<Name> names;
+};
+
+
+/* Turns a unit that parsed without errors into an entry. */
+std::string saveUnit(const SourceUnit &unit) {
+    EntryWriter writer;
+    writer.word(unit.tokens.size());
+    for (const Token &token : unit.tokens) {
+        writer.byte(token.type);
+        writer.name(token.vText);
+        writer.word(token.vInteger);
+        writer.number(token.vFloat);
+        writer.byte(token.type == Operator ? static_cast<unsigned>(token.opType) : 0);
+        writer.origin(token.origin);
+    }
+
+    const GameData &gamedata = unit.gamedata;
+    for (const NameUse &use : gamedata.unresolved) {
+        writer.unresolved.insert({use.value, use.origin});
+    }
+    writer.word(gamedata.symbols.declared.size());
+    for (const SymbolDef *symbol : gamedata.symbols.declared) {
+        writer.name(symbol->name);
+        writer.byte(symbol->type);
+        writer.word(symbol->value);
+        writer.origin(symbol->origin);
+    }
+    writer.word(gamedata.strings.all().size());
+    for (const Name &string : gamedata.strings.all()) {
+        writer.name(string);
+    }
+    writer.word(gamedata.functions.size());
+    for (FunctionDef *function : gamedata.functions) {
+        writer.visit(function);
+    }
+    writer.word(gamedata.vocabRaw.size());
+    for (const std::string &word : gamedata.vocabRaw) {
+        writer.text(word);
+    }
+
+    return writer.finish(sourceManager().text(unit.fileId).size());
+}
+
+/* Fills in an empty unit from an entry, returning false if the entry is
+ * damaged or was made from different text or by a different compiler.
+ */
+bool loadUnit(SourceView entry, SourceUnit &unit) {
+    EntryReader reader(entry, unit);
+    if (!reader.header(sourceManager().text(unit.fileId).size())) {
+        return false;
+    }
+    reader.tokens();
+    reader.globals();
+    return reader.ok() && reader.atEnd();
+}
+
+
+/* ************************************************************ *
+ * THE CACHE DIRECTORY                                          *
+ * ************************************************************ */
+
+UnitCache::UnitCache(const std::string &directory)
+: directory(directory) {
+    if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Could not create cache directory.");
+    }
+}
+
+/* Entries are named with two 64 bit hashes of the compiler version and the
+ * file contents, taken from different starting points. The file's size is
+ * also kept in the entry and checked when it is read.
+ */
+std::string UnitCache::entryFor(uint32_t fileId) const {
+    SourceView source = sourceManager().text(fileId);
+    uint64_t first = 0xCBF29CE484222325ull;
+    uint64_t second = 0x84222325CBF29CE4ull;
+    first = hashBytes(first, compilerVersion, strlen(compilerVersion) + 1);
+    second = hashBytes(second, compilerVersion, strlen(compilerVersion) + 1);
+    first = hashBytes(first, source.data(), source.size());
+    second = hashBytes(second, source.data(), source.size());
+
+    char entryName[40];
+    snprintf(entryName, sizeof(entryName), "%016llx%016llx",
+             static_cast<unsigned long long>(first),
+             static_cast<unsigned long long>(second));
+    return directory + "/" + entryName;
+}
+
+bool UnitCache::load(const std::string &entry, SourceUnit &unit) const {
+    try {
+        SourceFile file(entry);
+        return loadUnit(file.view(), unit);
+    } catch (std::runtime_error &e) {
+        return false;
+    }
+}
+
+/* The entry is written under a temporary name and then renamed into place,
+ * so other builds sharing the directory never see half an entry.
+ */
+void UnitCache::store(const std::string &entry, const SourceUnit &unit) const {
+    static std::atomic<unsigned> nextTemporary(0);
+
+    std::string contents = saveUnit(unit);
+    std::stringstream temporary;
+    temporary << entry << ".tmp" << getpid() << '_' << nextTemporary++;
+    std::ofstream out(temporary.str(), std::ios_base::binary);
+    out.write(contents.data(), contents.size());
+    out.close();
+    if (!out || rename(temporary.str().c_str(), entry.c_str()) != 0) {
+        remove(temporary.str().c_str());
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdint>
+#include <string>
+
+class SourceUnit;
+class SourceView;
+
+// converts a unit that parsed without errors to and from a cache entry
+std::string saveUnit(const SourceUnit &unit);
+bool loadUnit(SourceView entry, SourceUnit &unit);
+
+/* A directory of front end results from earlier builds. Each entry holds
+ * the tokens, declarations and functions parsed from one source file and is
+ * named for a hash of the file's contents and the compiler version, so an
+ * entry is only ever used for the exact text it was made from. Entries are
+ * mapped into memory when they are read.
+ *
+ * Only files that lexed and parsed without errors are stored. Any entry
+ * that cannot be read back is ignored and the file is parsed as normal.
+ */
+class UnitCache {
+public:
+    UnitCache(const std::string &directory);
+
+    std::string entryFor(uint32_t fileId) const;
+    bool load(const std::string &entry, SourceUnit &unit) const;
+    void store(const std::string &entry, const SourceUnit &unit) const;
+
+private:
+    std::string directory;
+};
+
+#endif
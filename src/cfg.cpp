@@ -0,0 +1,358 @@
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "gbuilder.h"
+
+/* Tidies the control flow of each function. The lines of a function are
+ * split into basic blocks at labels and after branches, jumps through
+ * blocks that contain nothing but another jump are sent straight to the
+ * final target, blocks that can never be reached are removed, and blocks
+ * that are only ever jumped to are moved to follow the jump so that the
+ * jump is no longer needed.
+ *
+ * Functions this can't be sure about, such as ones that branch to computed
+ * addresses, are left as they are.
+ */
+
+static const int opJump = 0x20;
+static const int opReturn = 0x31;
+static const int opThrow = 0x33;
+static const int opTailcall = 0x34;
+static const int opJumpAbs = 0x104;
+static const int opQuit = 0x120;
+static const int opRestart = 0x122;
+
+static bool isFunctionStart(const std::vector<AsmLine*> &lines, size_t i) {
+    if (i + 1 >= lines.size() || !nodeAs<LabelStmt>(lines[i])) {
+        return false;
+    }
+    AsmData *header = nodeAs<AsmData>(lines[i + 1]);
+    return header && !header->data.empty()
+        && (header->data[0] == 0xC0 || header->data[0] == 0xC1);
+}
+
+/* A label followed by data that is not a function header ends the function
+ * before it. Pooled strings are not among the lines yet when this pass
+ * runs, since placeStrings puts them ahead of the code afterwards. The
+ * check keeps any other labelled data from being treated as code.
+ */
+static bool isDataStart(const std::vector<AsmLine*> &lines, size_t i) {
+    return i + 1 < lines.size() && nodeAs<LabelStmt>(lines[i])
+        && nodeAs<AsmData>(lines[i + 1]);
+}
+
+// true if execution never carries on to the next line
+static bool endsFlow(const AsmStatement *stmt) {
+    switch (stmt->code->opcode) {
+        case opJump:
+        case opReturn:
+        case opThrow:
+        case opTailcall:
+        case opQuit:
+        case opRestart:
+            return true;
+    }
+    return false;
+}
+
+class BasicBlock {
+public:
+    BasicBlock()
+    : fallsThrough(true), branch(nullptr), target(-1), addressTaken(false),
+      reachable(false), predecessors(0)
+    { }
+
+    // the branch operand, if the block ends with a branch to a label
+    AsmOperand* branchOperand() const {
+        return branch ? branch->operands.back() : nullptr;
+    }
+    bool endsWithJump() const {
+        return branch && branch->code->opcode == opJump;
+    }
+
+    std::vector<AsmLine*> lines;
+    std::vector<LabelStmt*> labels;
+    bool fallsThrough;
+    AsmStatement *branch;
+    int target;
+    bool addressTaken;
+    bool reachable;
+    int predecessors;
+};
+
+class ControlFlow {
+public:
+    ControlFlow(GameData &gamedata)
+    : gamedata(gamedata), threaded(0), removed(0), moved(0)
+    { }
+
+    void optimize(std::vector<AsmLine*> &lines) {
+        std::vector<AsmLine*> out;
+        out.reserve(lines.size());
+        size_t i = 0;
+        while (i < lines.size()) {
+            if (!isFunctionStart(lines, i)) {
+                out.push_back(lines[i]);
+                ++i;
+                continue;
+            }
+            out.push_back(lines[i]);
+            out.push_back(lines[i + 1]);
+            size_t end = i + 2;
+            while (end < lines.size() && !isDataStart(lines, end)) {
+                ++end;
+            }
+            std::vector<AsmLine*> body(lines.begin() + i + 2, lines.begin() + end);
+            optimizeFunction(body);
+            out.insert(out.end(), body.begin(), body.end());
+            i = end;
+        }
+        lines.swap(out);
+    }
+
+    void report(std::ostream &out) const {
+        out << "CONTROL FLOW\n";
+        out << "    jumps threaded: " << threaded << '\n';
+        out << "    unreachable blocks removed: " << removed << '\n';
+        out << "    blocks moved to fall through: " << moved << '\n';
+    }
+
+private:
+    void optimizeFunction(std::vector<AsmLine*> &body) {
+        blocks.clear();
+        blockOf.clear();
+        if (!split(body) || !link()) {
+            return;
+        }
+        thread();
+        findReachable();
+        layout(body);
+    }
+
+    bool split(const std::vector<AsmLine*> &body) {
+        blocks.push_back(BasicBlock());
+        for (AsmLine *line : body) {
+            LabelStmt *label = nodeAs<LabelStmt>(line);
+            if (label) {
+                if (blocks.back().lines.size() > blocks.back().labels.size()) {
+                    blocks.push_back(BasicBlock());
+                }
+                blocks.back().labels.push_back(label);
+                blocks.back().lines.push_back(line);
+                blockOf[label->name] = blocks.size() - 1;
+                continue;
+            }
+
+            blocks.back().lines.push_back(line);
+            AsmStatement *stmt = nodeAs<AsmStatement>(line);
+            if (!stmt) {
+                return false;
+            }
+            if (stmt->code->opcode == opJumpAbs) {
+                return false;
+            }
+            if (stmt->code->relative || endsFlow(stmt)) {
+                if (stmt->code->relative) {
+                    blocks.back().branch = stmt;
+                }
+                blocks.back().fallsThrough = !endsFlow(stmt);
+                blocks.push_back(BasicBlock());
+            }
+        }
+        if (blocks.back().lines.empty() && blocks.size() > 1) {
+            blocks.pop_back();
+        }
+        return true;
+    }
+
+    /* Works out where each branch goes and which labels are used as
+     * addresses rather than branch targets; those blocks must stay, since
+     * there is no telling how they are reached.
+     */
+    bool link() {
+        for (BasicBlock &block : blocks) {
+            for (AsmLine *line : block.lines) {
+                AsmStatement *stmt = nodeAs<AsmStatement>(line);
+                if (!stmt) {
+                    continue;
+                }
+                for (AsmOperand *op : stmt->operands) {
+                    if (op == block.branchOperand() || op->isStack
+                            || op->value->type != Value::Identifier) {
+                        continue;
+                    }
+                    auto used = blockOf.find(op->value->text);
+                    if (used != blockOf.end()) {
+                        blocks[used->second].addressTaken = true;
+                    }
+                }
+            }
+
+            AsmOperand *op = block.branchOperand();
+            if (!op) {
+                continue;
+            }
+            if (op->isStack || op->isIndirect || op->value->type == Value::Local) {
+                return false;
+            }
+            if (op->value->type == Value::Identifier) {
+                auto target = blockOf.find(op->value->text);
+                if (target == blockOf.end()) {
+                    return false;
+                }
+                block.target = target->second;
+            }
+        }
+        return true;
+    }
+
+    // the block a branch to this one really ends up at
+    int finalTarget(int target) {
+        for (size_t steps = 0; steps < blocks.size(); ++steps) {
+            const BasicBlock &block = blocks[target];
+            if (block.lines.size() != block.labels.size() + 1 || !block.endsWithJump()
+                    || block.target < 0 || block.addressTaken) {
+                break;
+            }
+            target = block.target;
+        }
+        return target;
+    }
+
+    void thread() {
+        for (BasicBlock &block : blocks) {
+            if (block.target < 0) {
+                continue;
+            }
+            int target = finalTarget(block.target);
+            if (target != block.target) {
+                retarget(block, target);
+                ++threaded;
+            }
+        }
+    }
+
+    void retarget(BasicBlock &block, int target) {
+        AsmOperand *op = gamedata.arena.make<AsmOperand>();
+        op->value = gamedata.arena.make<Value>(blocks[target].labels.front()->name);
+        block.branch->operands.back() = op;
+        block.target = target;
+    }
+
+    void findReachable() {
+        std::vector<int> pending;
+        pending.push_back(0);
+        for (unsigned i = 0; i < blocks.size(); ++i) {
+            if (blocks[i].addressTaken) {
+                pending.push_back(i);
+            }
+        }
+        while (!pending.empty()) {
+            int index = pending.back();
+            pending.pop_back();
+            BasicBlock &block = blocks[index];
+            if (block.reachable) {
+                continue;
+            }
+            block.reachable = true;
+            if (block.fallsThrough && index + 1 < static_cast<int>(blocks.size())) {
+                pending.push_back(index + 1);
+            }
+            if (block.target >= 0) {
+                pending.push_back(block.target);
+            }
+        }
+
+        for (unsigned i = 0; i < blocks.size(); ++i) {
+            BasicBlock &block = blocks[i];
+            if (!block.reachable) {
+                ++removed;
+                continue;
+            }
+            if (block.addressTaken) {
+                ++block.predecessors;
+            }
+            if (block.fallsThrough && i + 1 < blocks.size()) {
+                ++blocks[i + 1].predecessors;
+            }
+            if (block.target >= 0) {
+                ++blocks[block.target].predecessors;
+            }
+        }
+    }
+
+    /* Puts the reachable blocks back together. When a block ends with a jump
+     * to a block that nothing else reaches, the target and any blocks it
+     * falls through to are moved up to follow the jump, and the jump is
+     * dropped.
+     */
+    void layout(std::vector<AsmLine*> &body) {
+        std::vector<int> order;
+        for (unsigned i = 0; i < blocks.size(); ++i) {
+            if (blocks[i].reachable) {
+                order.push_back(i);
+            }
+        }
+        std::vector<bool> placed(blocks.size(), false);
+
+        body.clear();
+        for (size_t i = 0; i < order.size(); ++i) {
+            int index = order[i];
+            if (placed[index]) {
+                continue;
+            }
+            placeChain(body, placed, index);
+        }
+    }
+
+    void placeChain(std::vector<AsmLine*> &body, std::vector<bool> &placed, int index) {
+        while (true) {
+            BasicBlock &block = blocks[index];
+            placed[index] = true;
+            int target = block.target;
+            bool pullUp = block.endsWithJump() && target > 0 && !placed[target]
+                && blocks[target].predecessors == 1 && chainEnds(target);
+            if (pullUp) {
+                body.insert(body.end(), block.lines.begin(), block.lines.end() - 1);
+                ++moved;
+                index = target;
+                continue;
+            }
+            body.insert(body.end(), block.lines.begin(), block.lines.end());
+            if (!block.fallsThrough || index + 1 >= static_cast<int>(blocks.size())) {
+                return;
+            }
+            index = index + 1;
+            if (placed[index] || !blocks[index].reachable) {
+                return;
+            }
+        }
+    }
+
+    // true if the blocks from index on reach a block that doesn't fall through
+    bool chainEnds(int index) {
+        for (unsigned i = index; i < blocks.size(); ++i) {
+            if (!blocks[i].fallsThrough) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    GameData &gamedata;
+    std::vector<BasicBlock> blocks;
+    std::unordered_map<Name, int> blockOf;
+    int threaded;
+    int removed;
+    int moved;
+};
+
+void optimizeControlFlow(GameData &gamedata, std::vector<AsmLine*> &lines, bool showReport,
+                         std::ostream &out) {
+    ControlFlow flow(gamedata);
+    flow.optimize(lines);
+    if (showReport) {
+        flow.report(out);
+    }
+}
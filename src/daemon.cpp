@@ -0,0 +1,460 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "daemon.h"
+#include "gbuilder.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+    stopRequested = 1;
+}
+
+// splits a path into the directory inotify watches and the name it reports
+static void splitPath(const std::string &path, std::string &directory, std::string &base) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        directory = ".";
+        base = path;
+    } else {
+        directory = slash == 0 ? "/" : path.substr(0, slash);
+        base = path.substr(slash + 1);
+    }
+}
+
+static bool writeAll(int fd, const std::string &text) {
+    size_t done = 0;
+    while (done < text.size()) {
+        ssize_t count = write(fd, text.data() + done, text.size() - done);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        done += count;
+    }
+    return true;
+}
+
+static bool makeSocketAddress(const std::string &path, sockaddr_un &address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path \"" << path << "\" is too long.\n";
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+
+/* ************************************************************ *
+ * THE DAEMON                                                   *
+ * ************************************************************ */
+
+/* One source file from the project. A file that lexed and parsed cleanly
+ * is kept as a cache entry, which is turned back into a SourceUnit for each
+ * build; a file with problems keeps its diagnostics instead.
+ */
+class WatchedFile {
+public:
+    WatchedFile()
+    : fileId(0), errors(new ErrorLogger)
+    { }
+
+    std::string name;
+    std::string watchPath;
+    uint32_t fileId;
+    std::string entry;
+    std::unique_ptr<ErrorLogger> errors;
+};
+
+class Daemon {
+public:
+    Daemon(const char *projectFile, const std::string &socketPath, const BuildOptions &options)
+    : projectFile(projectFile), socketPath(socketPath), options(options),
+      inotifyFd(-1), listenFd(-1), stopping(false)
+    { }
+    ~Daemon();
+
+    int run();
+
+private:
+    bool loadProject();
+    void watch(const std::string &path, std::string &watchPath);
+    bool openFile(WatchedFile &file);
+    void parseFiles(const std::vector<WatchedFile*> &changed);
+    void refresh();
+    bool listen();
+    void serve(int client);
+    bool build(bool writeImage, std::ostream &reply);
+
+    std::string projectFile;
+    std::string projectWatchPath;
+    std::string socketPath;
+    const BuildOptions &options;
+    std::unique_ptr<ProjectFile> project;
+    std::vector<std::unique_ptr<WatchedFile> > files;
+    std::map<int, std::string> watchedDirectories;
+    int inotifyFd;
+    int listenFd;
+    bool stopping;
+};
+
+Daemon::~Daemon() {
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+    }
+}
+
+int Daemon::run() {
+    // the daemon keeps files loaded while they are edited, and a mapping of
+    // a file that is cut short faults when the missing part is read
+    sourceManager().setMapFiles(false);
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        std::cerr << "Could not start watching files: " << strerror(errno) << "\n";
+        return 1;
+    }
+    watch(projectFile, projectWatchPath);
+    if (!loadProject() || !listen()) {
+        return 1;
+    }
+    std::cout << "Watching " << files.size() << " file(s); listening on " << socketPath << "\n";
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!stopping && !stopRequested) {
+        pollfd waiting[2] = {
+            { inotifyFd, POLLIN, 0 },
+            { listenFd, POLLIN, 0 }
+        };
+        if (poll(waiting, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Daemon stopped: " << strerror(errno) << "\n";
+            return 1;
+        }
+        if (waiting[0].revents & POLLIN) {
+            refresh();
+        }
+        if (waiting[1].revents & POLLIN) {
+            int client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                serve(client);
+                close(client);
+            }
+        }
+    }
+    std::cout << "Daemon stopped.\n";
+    return 0;
+}
+
+/* Reads the project file and parses every source file it lists. Files that
+ * were already part of the project keep their ids. If the project file
+ * cannot be read the previous one stays in use.
+ */
+bool Daemon::loadProject() {
+    std::unique_ptr<ProjectFile> newProject(load_project(projectFile.c_str()));
+    if (!newProject) {
+        return false;
+    }
+    if (newProject->sourceFiles.empty()) {
+        std::cerr << "No source files specified!\n";
+        return false;
+    }
+
+    std::vector<std::unique_ptr<WatchedFile> > newFiles;
+    for (const std::string &filename : newProject->sourceFiles) {
+        std::unique_ptr<WatchedFile> file(new WatchedFile);
+        file->name = filename;
+        for (auto &oldFile : files) {
+            if (oldFile && oldFile->name == filename) {
+                file->fileId = oldFile->fileId;
+                oldFile.reset();
+                break;
+            }
+        }
+        watch(filename, file->watchPath);
+        newFiles.push_back(std::move(file));
+    }
+    files.swap(newFiles);
+    project = std::move(newProject);
+
+    std::vector<WatchedFile*> all;
+    for (auto &file : files) {
+        all.push_back(file.get());
+    }
+    parseFiles(all);
+    return true;
+}
+
+void Daemon::watch(const std::string &path, std::string &watchPath) {
+    std::string directory, base;
+    splitPath(path, directory, base);
+    watchPath = directory + "/" + base;
+
+    const uint32_t events = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+    int wd = inotify_add_watch(inotifyFd, directory.c_str(), events);
+    if (wd < 0) {
+        std::cerr << "Could not watch " << directory << ": " << strerror(errno) << "\n";
+        return;
+    }
+    watchedDirectories[wd] = directory;
+}
+
+/* Loads the current text of a file. A file that is missing is given a
+ * pseudo-file id so that it can be loaded under that id once it appears.
+ */
+bool Daemon::openFile(WatchedFile &file) {
+    try {
+        if (file.fileId == 0) {
+            file.fileId = sourceManager().addFile(file.name);
+        } else {
+            sourceManager().reload(file.fileId);
+        }
+        return true;
+    } catch (std::runtime_error &e) {
+        if (file.fileId == 0) {
+            file.fileId = sourceManager().addPseudoFile(file.name);
+        }
+        return false;
+    }
+}
+
+void Daemon::parseFiles(const std::vector<WatchedFile*> &changed) {
+    std::unique_ptr<UnitCache> cache;
+    if (!project->cacheDirectory.empty()) {
+        try {
+            cache.reset(new UnitCache(project->cacheDirectory));
+        } catch (std::runtime_error &e) {
+        }
+    }
+
+    std::vector<std::unique_ptr<SourceUnit> > units;
+    std::vector<WatchedFile*> parsed;
+    for (WatchedFile *file : changed) {
+        file->entry.clear();
+        file->errors.reset(new ErrorLogger);
+        if (!openFile(*file)) {
+            file->errors->add(ErrorLogger::Error, Origin(file->fileId, 0), "could not read file.");
+            continue;
+        }
+        unsigned unitIndex = 0;
+        while (files[unitIndex].get() != file) {
+            ++unitIndex;
+        }
+        units.push_back(std::unique_ptr<SourceUnit>(new SourceUnit(file->fileId, unitIndex)));
+        parsed.push_back(file);
+    }
+
+    parseSourceUnits(units, options.jobs, options.errorLimit, cache.get());
+    for (unsigned i = 0; i < units.size(); ++i) {
+        if (units[i]->errors.empty()) {
+            parsed[i]->entry = saveUnit(*units[i]);
+        } else {
+            parsed[i]->errors->append(units[i]->errors);
+        }
+    }
+}
+
+/* Picks up whatever inotify has reported since the last call. Events are
+ * gathered up first so that a file saved in several steps is only parsed
+ * once.
+ */
+void Daemon::refresh() {
+    std::set<WatchedFile*> changed;
+    bool projectChanged = false;
+
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (ssize_t pos = 0; pos < length; ) {
+            const inotify_event *event = reinterpret_cast<const inotify_event*>(buffer + pos);
+            pos += sizeof(inotify_event) + event->len;
+            if (event->len == 0) {
+                continue;
+            }
+            auto directory = watchedDirectories.find(event->wd);
+            if (directory == watchedDirectories.end()) {
+                continue;
+            }
+            std::string path = directory->second + "/" + event->name;
+            if (path == projectWatchPath) {
+                projectChanged = true;
+            }
+            for (auto &file : files) {
+                if (file->watchPath == path) {
+                    changed.insert(file.get());
+                }
+            }
+        }
+    }
+
+    if (projectChanged) {
+        std::cout << "Project file changed; reloading.\n";
+        loadProject();
+    } else if (!changed.empty()) {
+        for (WatchedFile *file : changed) {
+            std::cout << "Reparsing " << file->name << "\n";
+        }
+        parseFiles(std::vector<WatchedFile*>(changed.begin(), changed.end()));
+    }
+}
+
+bool Daemon::listen() {
+    sockaddr_un address;
+    if (!makeSocketAddress(socketPath, address)) {
+        return false;
+    }
+
+    // don't take the socket from a daemon that is still running
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        close(probe);
+        std::cerr << "A daemon is already listening on " << socketPath << "\n";
+        return false;
+    }
+    if (probe >= 0) {
+        close(probe);
+    }
+    unlink(socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0
+            || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(listenFd, 8) != 0) {
+        std::cerr << "Could not listen on " << socketPath << ": " << strerror(errno) << "\n";
+        if (listenFd >= 0) {
+            close(listenFd);
+            listenFd = -1;
+        }
+        return false;
+    }
+    return true;
+}
+
+/* Handles one request. Changes that inotify has seen but the daemon has not
+ * yet picked up are dealt with first, so a build always sees files that were
+ * saved before the request was sent.
+ */
+void Daemon::serve(int client) {
+    timeval timeout = { 5, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char c;
+    while (request.size() < 64 && read(client, &c, 1) == 1 && c != '\n') {
+        request += c;
+    }
+    if (!request.empty() && request.back() == '\r') {
+        request.pop_back();
+    }
+
+    refresh();
+    std::stringstream reply;
+    if (request == "build" || request == "check") {
+        bool writeImage = request == "build";
+        bool success = build(writeImage, reply);
+        reply << (success ? "ok" : "failed") << "\n";
+    } else if (request == "stop") {
+        stopping = true;
+        reply << "ok\n";
+    } else {
+        reply << "unknown request \"" << request << "\"\nfailed\n";
+    }
+    writeAll(client, reply.str());
+}
+
+/* Reloads every file's parsed entry and runs the rest of the build over
+ * the whole program. Nothing after parsing is kept from earlier builds.
+ */
+bool Daemon::build(bool writeImage, std::ostream &reply) {
+    std::vector<std::unique_ptr<SourceUnit> > units;
+    for (auto &file : files) {
+        SourceUnit *unit = new SourceUnit(file->fileId, units.size());
+        units.push_back(std::unique_ptr<SourceUnit>(unit));
+        if (file->entry.empty()) {
+            unit->errors.append(*file->errors);
+        } else if (!loadUnit(SourceView(file->entry), *unit)) {
+            unit->errors.add(ErrorLogger::Error, Origin(file->fileId, 0), "could not reload parsed file.");
+        }
+    }
+
+    ErrorLogger errors;
+    bool success = buildProgram(units, project.get(), options, writeImage, errors, reply);
+    for (auto &message : errors) {
+        reply << message.format() << "\n";
+    }
+    reply << errors.errorCount() << " error(s) occured.\n";
+    return success;
+}
+
+
+/* ************************************************************ *
+ * ENTRY POINTS                                                 *
+ * ************************************************************ */
+
+int runDaemon(const char *projectFile, const std::string &socketPath, const BuildOptions &options) {
+    Daemon daemon(projectFile, socketPath, options);
+    return daemon.run();
+}
+
+int sendRequest(const std::string &socketPath, const std::string &request) {
+    sockaddr_un address;
+    if (!makeSocketAddress(socketPath, address)) {
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "No daemon is listening on " << socketPath << "\n";
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    writeAll(fd, request + "\n");
+    std::string reply;
+    char buffer[4096];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+        reply.append(buffer, count);
+    }
+    close(fd);
+
+    std::cout << reply;
+    // the last line says how it went
+    size_t lastLine = reply.rfind('\n', reply.size() >= 2 ? reply.size() - 2 : 0);
+    lastLine = lastLine == std::string::npos ? 0 : lastLine + 1;
+    return reply.compare(lastLine, std::string::npos, "ok\n") == 0 ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <string>
+
+class BuildOptions;
+
+/* Keeps a project's source files parsed between builds: a parse cache
+ * behind a socket. The daemon watches the project file and every source
+ * file with inotify, and when one changes only that file is lexed and
+ * parsed again. Everything after parsing is done over the whole program for
+ * each build, as a one-off build does it, since a change to one file's
+ * constants or globals changes the code of functions in other files.
+ * Builds are asked for over a Unix socket: a client sends one line
+ * ("build", "check" or "stop") and gets back the diagnostics, ending with a
+ * line that is "ok" or "failed".
+ */
+int runDaemon(const char *projectFile, const std::string &socketPath, const BuildOptions &options);
+
+// sends one request to a running daemon and prints the reply
+int sendRequest(const std::string &socketPath, const std::string &request);
+
+#endif
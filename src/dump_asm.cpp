@@ -2,53 +2,46 @@
 #include <iostream>
 
 #include "gbuilder.h"
+#include "flatcode.h"
 
-class AsmPrinter : public AsmWalker {
-public:
-    virtual void visit(Value *stmt) {
-        switch(stmt->type) {
-            case Value::Constant:
-                std::cout << " c:" << stmt->value;
-                break;
-            case Value::Local:
-                std::cout << " l:" << stmt->value;
+static void printOperand(const FlatCode &code, const FlatOperand &op, std::ostream &out) {
+    switch (op.kind) {
+        case FlatOperand::Constant:
+            out << " c:" << op.value;
+            break;
+        case FlatOperand::Local:
+            out << " l:" << op.value;
+            break;
+        case FlatOperand::Label:
+            out << " i:~" << code.labelNames[op.value].str() << '~';
+            break;
+        case FlatOperand::Stack:
+            out << " sp";
+            break;
+    }
+}
+
+void dump_asm(const FlatCode &code, std::ostream &out) {
+    out << "** Assembly Dump **\n";
+    for (const FlatLine &line : code.lines) {
+        switch (line.kind) {
+            case FlatLine::Instruction:
+                out << "asm " << line.code->name << " (" << std::hex << line.code->opcode << std::dec << ')';
+                for (uint32_t i = 0; i < line.count; ++i) {
+                    printOperand(code, code.operands[line.first + i], out);
+                }
+                out << '\n';
                 break;
-            case Value::Identifier:
-                std::cout << " i:~" << stmt->text << '~';
+            case FlatLine::Data:
+                out << std::uppercase << std::hex << "DATA";
+                for (uint32_t i = 0; i < line.count; ++i) {
+                    out << " 0x" << static_cast<int>(code.bytes[line.first + i]);
+                }
+                out << std::dec << '\n';
                 break;
-            default:
+            case FlatLine::Label:
+                out << "\nLABEL " << code.labelNames[line.first].str() << "\n";
                 break;
         }
-}
-    virtual void visit(AsmStatement *stmt) {
-        std::cout << "asm " << stmt->opname << " (" << std::hex << stmt->opcode << std::dec << ')';
-        for (auto op : stmt->operands) {
-            if (op->isStack) {
-                std::cout << " sp";
-            } else {
-                op->value->accept(this);
-            }
-        }
-        std::cout << '\n';
-    }
-    virtual void visit(AsmData *data) {
-        std::cout << std::uppercase << std::hex << "DATA";
-        for (unsigned char &ch : data->data) {
-            std::cout << " 0x" << (int)ch;
-        }
-        std::cout << std::dec << '\n';
-    }
-    virtual void visit(LabelStmt *label) {
-        std::cout << "\nLABEL " << label->name << "\n";
-    }
-};
-
-
-void dump_asm(std::vector<std::shared_ptr<AsmLine> > lines) {
-    AsmPrinter asmPrinter;
-
-    std::cout << "** Assembly Dump **\n";
-    for (auto line : lines) {
-        line->accept(&asmPrinter);
     }
 }
@@ -2,114 +2,130 @@
 
 #include "gbuilder.h"
 
-class PrintExpressionWalker : public ExpressionWalker {
-    virtual void visit(NameExpression *expr) {
-        std::cout << "$" << expr->name;
+class PrintExpressionWalker : public AstWalker<PrintExpressionWalker> {
+public:
+    PrintExpressionWalker(std::ostream &out)
+    : out(out)
+    { }
+
+    void visit(NameExpression *expr) {
+        out << "$" << expr->name.str();
     }
 
-    virtual void visit(LiteralExpression *expr) {
-        std::cout << "#" << expr->litValue;
+    void visit(LiteralExpression *expr) {
+        out << "#" << expr->litValue;
     }
 
-    virtual void visit(PrefixOpExpression *expr) {
+    void visit(PrefixOpExpression *expr) {
 
     }
+
+private:
+    std::ostream &out;
 };
 
-class PrintAstWalker : public AstWalker {
+class PrintAstWalker : public AstWalker<PrintAstWalker> {
 public:
-    virtual void visit(Value *stmt) {
+    PrintAstWalker(std::ostream &out)
+    : out(out)
+    { }
+
+    void visit(Value *stmt) {
         switch(stmt->type) {
             case Value::Constant:
-                std::cout << " c:" << stmt->value;
+                out << " c:" << stmt->value;
                 break;
             case Value::Local:
-                std::cout << " l:" << stmt->value;
+                out << " l:" << stmt->value;
                 break;
             case Value::Identifier:
-                std::cout << " i:~" << stmt->text << '~';
+                out << " i:~" << stmt->text.str() << '~';
+                break;
+            case Value::String:
+                out << " s:~" << stmt->text.str() << '~';
                 break;
             default:
                 break;
         }
     }
-    virtual void visit(AsmStatement *stmt) {
+    void visit(AsmStatement *stmt) {
         spaces();
-        std::cout << "ASM  " << stmt->opname << " (" << stmt->opcode << ')';
+        out << "ASM  " << stmt->code->name << " (" << stmt->code->opcode << ')';
         for (auto op : stmt->operands) {
             if (op->isStack) {
-                std::cout << " sp";
+                out << " sp";
             } else {
-                op->value->accept(this);
+                visit(op->value);
             }
         }
-        std::cout << '\n';
+        out << '\n';
     }
-    virtual void visit(AsmData *stmt) {
+    void visit(AsmData *stmt) {
     }
-    virtual void visit(CodeBlock *stmt) {
+    void visit(CodeBlock *stmt) {
         spaces();
-        std::cout << "BEGIN  ";
+        out << "BEGIN  ";
         printOrigin(stmt->origin);
-        std::cout << ' ';
+        out << ' ';
         printSymbols(stmt->locals);
         ++depth;
         for (auto s : stmt->statements) {
             curBlock = stmt;
-            s->accept(this);
+            walk(s);
         }
         --depth;
         spaces();
-        std::cout << "END\n";
+        out << "END\n";
     }
-    virtual void visit(FunctionDef *stmt) {
+    void visit(FunctionDef *stmt) {
         depth = 0;
-        std::cout << "\nFUNCTION " << stmt->name;
-        std::cout << " (locals: " << stmt->localCount << ") ";
+        out << "\nFUNCTION " << stmt->name.str();
+        out << " (locals: " << stmt->localCount << ") ";
         printOrigin(stmt->origin);
-        std::cout << ' ';
+        out << ' ';
         printSymbols(stmt->args);
         if (stmt->code) {
-            stmt->code->accept(this);
+            visit(stmt->code);
         } else {
-            std::cout << "   (bad function body)\n";
+            out << "   (bad function body)\n";
         }
     }
-    virtual void visit(ReturnDef *stmt) {
+    void visit(ReturnDef *stmt) {
         spaces();
-        std::cout << "RETURN ";
-        PrintExpressionWalker ewalk;
-        stmt->retValue->accept(&ewalk);
-        std::cout << "\n";
+        out << "RETURN ";
+        PrintExpressionWalker ewalk(out);
+        ewalk.walk(stmt->retValue);
+        out << "\n";
     }
-    virtual void visit(ExpressionStmt *stmt) {
+    void visit(ExpressionStmt *stmt) {
         spaces();
-        std::cout << "STMT ";
-        PrintExpressionWalker ewalk;
-        stmt->expr->accept(&ewalk);
-        std::cout << "\n";
+        out << "STMT ";
+        PrintExpressionWalker ewalk(out);
+        ewalk.walk(stmt->expr);
+        out << "\n";
     }
-    virtual void visit(LabelStmt *stmt) {
+    void visit(LabelStmt *stmt) {
         spaces();
-        std::cout << "LABEL ~" << stmt->name << "~\n";
+        out << "LABEL ~" << stmt->name.str() << "~\n";
     }
 
 private:
     void printOrigin(const Origin &origin) {
-        std::cout << "[" << origin.file << ":" << origin.line << ":" << origin.column << "]";
+        out << "[" << origin.file() << ":" << origin.line() << ":" << origin.column() << "]";
     }
     void printSymbols(SymbolTable &symbols) {
-        std::cout << "(" << symbols.symbols.size() << ":";
-        for (auto &s : symbols.symbols) {
-            std::cout << "  (" << s.second->value << ") ~" << s.second->name << '~';
+        out << "(" << symbols.size() << ":";
+        for (auto s : symbols.declared) {
+            out << "  (" << s->value << ") ~" << s->name.str() << '~';
         }
-        std::cout << " )\n";
+        out << " )\n";
     }
     void spaces() const {
         for (int i = 0; i < depth; ++i) {
-            std::cout << "   ";
+            out << "   ";
         }
     }
+    std::ostream &out;
     int depth;
     CodeBlock *curBlock;
 };
@@ -117,31 +133,29 @@ private:
 
 
 
-void printAST(GameData &gd) {
+void printAST(GameData &gd, std::ostream &out) {
 
-    std::cout << "VOCABULARY: " << gd.vocabRaw.size() << " :";
+    out << "VOCABULARY: " << gd.vocabRaw.size() << " :";
     if (!gd.vocabRaw.empty()) {
         for (const std::string &s : gd.vocabRaw) {
-            std::cout << ' ' << s;
+            out << ' ' << s;
         }
     }
 
-    std::cout << "\n\nSTRINGS: " << gd.stringtable.size() << '\n';
-    if (!gd.stringtable.empty()) {
-        for (auto &s : gd.stringtable) {
-            std::cout << "   " << s.first << ": ~" << s.second << "~\n";
-        }
+    out << "\n\nSTRINGS: " << gd.strings.all().size() << '\n';
+    for (const Name &s : gd.strings.all()) {
+        out << "   ~" << s.str() << "~\n";
     }
 
-    std::cout << "\nGLOBALS (" << gd.symbols.symbols.size() << "):\n";
-    for (auto &s : gd.symbols.symbols) {
-        std::cout << "   " << s.second->name << " (" << s.second->type << ") = " << s.second->value << '\n';
+    out << "\nGLOBALS (" << gd.symbols.size() << "):\n";
+    for (auto s : gd.symbols.declared) {
+        out << "   " << s->name.str() << " (" << s->type << ") = " << s->value << '\n';
     }
 
-    PrintAstWalker aw;
-    std::cout << "\nFUNCTIONS: " << gd.functions.size() << '\n';
+    PrintAstWalker aw(out);
+    out << "\nFUNCTIONS: " << gd.functions.size() << '\n';
     for (auto f : gd.functions) {
-        f->accept(&aw);
+        aw.visit(f);
     }
 
 }
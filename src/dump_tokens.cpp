@@ -26,28 +26,28 @@ std::string escapeString(const std::string &text) {
 }
 
 
-void dump_tokens(const std::vector<Token> &tokens) {
+void dump_tokens(const std::vector<Token> &tokens, std::ostream &out) {
     const int maxStringSize = 20;
 
     for (const auto &token : tokens) {
-        std::cout << std::setw(3) << std::right << token.type << ": ";
-        std::cout << std::setw(15) << std::left << tokenTypeName(token.type);
+        out << std::setw(3) << std::right << token.type << ": ";
+        out << std::setw(15) << std::left << tokenTypeName(token.type);
         if (token.type == Identifier || token.type == String || token.type == ReservedWord) {
-            const std::string &text = escapeString(token.vText);
+            const std::string &text = escapeString(token.vText.str());
             if (text.size() > maxStringSize) {
-                std::cout << text.substr(0,maxStringSize - 3) << "...";
+                out << text.substr(0,maxStringSize - 3) << "...";
             } else {
-                std::cout << std::setw(maxStringSize) << text;
+                out << std::setw(maxStringSize) << text;
             }
         } else if (token.type == Integer) {
-            std::cout << std::setw(maxStringSize) << token.vInteger;
+            out << std::setw(maxStringSize) << token.vInteger;
         } else if (token.type == Float) {
-            std::cout << std::setw(maxStringSize) << token.vFloat;
+            out << std::setw(maxStringSize) << token.vFloat;
         } else {
-            std::cout << "                    ";
+            out << "                    ";
         }
-        std::cout << ' ' << token.origin.file << ':' << token.origin.line << ':' << token.origin.column;
-        std::cout << "\n";
+        out << ' ' << token.origin.file() << ':' << token.origin.line() << ':' << token.origin.column();
+        out << "\n";
     }
-    std::cout << std::right;
+    out << std::right;
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/* The one place instructions are turned into bytes. The encoder writes to
+ * any sink with a put(unsigned char) method: a SizeCounter when only the
+ * length is wanted, or the image being built. Since layout and emission go
+ * through the same code, an instruction always takes up the room that was
+ * set aside for it.
+ *
+ * gbuilder.h and flatcode.h must be included before this header.
+ */
+
+class SizeCounter {
+public:
+    SizeCounter()
+    : size(0)
+    { }
+
+    void put(unsigned char) {
+        ++size;
+    }
+
+    int size;
+};
+
+template<class Sink>
+void encodeBytes(Sink &sink, uint32_t value, int size) {
+    for (int shift = (size - 1) * 8; shift >= 0; shift -= 8) {
+        sink.put((value >> shift) & 0xFF);
+    }
+}
+
+/* Writes out an instruction. The operands are filled in from the label
+ * addresses given, and a branch is made relative to end, the address just
+ * past the instruction. With no addresses only the length matters, and
+ * every operand is written as zero.
+ */
+template<class Sink>
+void encodeInstruction(Sink &sink, const AsmCode &code, const FlatOperand *operands, unsigned count,
+                       const std::vector<int> *labelAddresses = nullptr, int end = 0) {
+    encodeBytes(sink, code.encoded, code.width);
+
+    // two modes to a byte, the first operand's in the low nibble
+    for (unsigned i = 0; i < count; i += 2) {
+        int modes = operands[i].mode();
+        if (i + 1 < count) {
+            modes |= operands[i + 1].mode() << 4;
+        }
+        sink.put(modes);
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        const FlatOperand &op = operands[i];
+        if (op.kind == FlatOperand::Stack) {
+            continue;
+        }
+        int value = 0;
+        if (labelAddresses) {
+            value = op.value;
+            if (op.kind == FlatOperand::Label) {
+                value = std::max((*labelAddresses)[op.value], 0);
+            }
+            if (code.relative && i == count - 1) {
+                value = value - end + 2;
+            }
+        }
+        encodeBytes(sink, value, op.size);
+    }
+}
+
+#endif
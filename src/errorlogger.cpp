@@ -11,6 +11,12 @@ void ErrorLogger::add(Type type, const Origin &origin, const std::string &messag
     errors.push_back(std::move(msg));
 }
 
+void ErrorLogger::append(const ErrorLogger &other) {
+    for (const Message &msg : other.errors) {
+        add(msg.type, msg.origin, msg.message);
+    }
+}
+
 std::string ErrorLogger::Message::format() const {
     std::stringstream msg;
     switch(type) {
@@ -18,6 +24,6 @@ std::string ErrorLogger::Message::format() const {
         case Warning: msg << "WARNING "; break;
         case Notice: msg << "NOTICE "; break;
     }
-    msg << origin.file << ':' << origin.line << ':' << origin.column << ": " << message;
+    msg << origin.file() << ':' << origin.line() << ':' << origin.column() << ": " << message;
     return msg.str();
 }
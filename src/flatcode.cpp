@@ -0,0 +1,181 @@
+#include "gbuilder.h"
+#include "flatcode.h"
+#include "encode.h"
+#include "parallel.h"
+
+int FlatCode::labelId(const Name &name) {
+    auto known = labelIds.find(name);
+    if (known != labelIds.end()) {
+        return known->second;
+    }
+    int id = labelNames.size();
+    labelIds[name] = id;
+    labelNames.push_back(name);
+    labelAddresses.push_back(-1);
+    return id;
+}
+
+int FlatCode::findLabel(const Name &name) const {
+    auto known = labelIds.find(name);
+    return known == labelIds.end() ? -1 : known->second;
+}
+
+int FlatCode::measure(const FlatLine &line) const {
+    SizeCounter counter;
+    encodeInstruction(counter, *line.code, &operands[line.first], line.count);
+    return counter.size;
+}
+
+/* Converts an operand. Without a program to number labels in, label
+ * references all come out as label 0, which is enough to measure them.
+ */
+FlatOperand flattenOperand(AsmOperand *op, FlatCode *code) {
+    FlatOperand flat;
+    flat.isIndirect = op->isIndirect;
+    flat.size = op->getSize();
+    if (op->isStack) {
+        flat.kind = FlatOperand::Stack;
+        return flat;
+    }
+    switch (op->value->type) {
+        case Value::Constant:
+            flat.kind = FlatOperand::Constant;
+            flat.value = op->value->value;
+            break;
+        case Value::Local:
+            flat.kind = FlatOperand::Local;
+            flat.value = op->value->value;
+            break;
+        case Value::Identifier:
+        case Value::String:
+            flat.kind = FlatOperand::Label;
+            flat.value = code ? code->labelId(op->value->text) : 0;
+            break;
+    }
+    return flat;
+}
+
+static FlatCode flattenPart(const std::vector<AsmLine*> &lines, size_t begin, size_t end) {
+    FlatCode code;
+    code.lines.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+        AsmLine *line = lines[i];
+        FlatLine flat;
+        if (AsmStatement *stmt = nodeAs<AsmStatement>(line)) {
+            flat.kind = FlatLine::Instruction;
+            flat.code = stmt->code;
+            flat.first = code.operands.size();
+            flat.count = stmt->operands.size();
+            for (AsmOperand *op : stmt->operands) {
+                code.operands.push_back(flattenOperand(op, &code));
+            }
+            flat.size = code.measure(flat);
+        } else if (AsmData *data = nodeAs<AsmData>(line)) {
+            flat.kind = FlatLine::Data;
+            flat.first = code.bytes.size();
+            flat.count = data->data.size();
+            flat.size = data->data.size();
+            code.bytes.insert(code.bytes.end(), data->data.begin(), data->data.end());
+        } else if (LabelStmt *label = nodeAs<LabelStmt>(line)) {
+            flat.kind = FlatLine::Label;
+            flat.first = code.labelId(label->name);
+        }
+        code.lines.push_back(flat);
+    }
+    return code;
+}
+
+bool startsSection(const std::vector<AsmLine*> &lines, size_t i) {
+    return i + 1 < lines.size() && nodeAs<LabelStmt>(lines[i])
+        && nodeAs<AsmData>(lines[i + 1]);
+}
+
+/* Flattens the program in parts, using up to jobs threads. Each part is a
+ * run of whole functions and strings with labels numbered on their own.
+ * The parts are then appended in order, and their labels are renumbered as
+ * they are met, so every label gets the same number it would get from
+ * flattening the lines in one go.
+ */
+FlatCode flatten(const std::vector<AsmLine*> &lines, int jobs) {
+    static const size_t partLines = 4096;
+    std::vector<size_t> partStarts;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (partStarts.empty() || (i - partStarts.back() >= partLines && startsSection(lines, i))) {
+            partStarts.push_back(i);
+        }
+    }
+    partStarts.push_back(lines.size());
+
+    std::vector<FlatCode> parts(partStarts.size() - 1);
+    forEachIndex(parts.size(), jobs, [&lines, &partStarts, &parts](size_t i, unsigned) {
+        parts[i] = flattenPart(lines, partStarts[i], partStarts[i + 1]);
+    });
+
+    FlatCode code;
+    size_t operandCount = 0, byteCount = 0;
+    for (const FlatCode &part : parts) {
+        operandCount += part.operands.size();
+        byteCount += part.bytes.size();
+    }
+    code.lines.reserve(lines.size());
+    code.operands.reserve(operandCount);
+    code.bytes.reserve(byteCount);
+    for (const FlatCode &part : parts) {
+        std::vector<int> ids;
+        ids.reserve(part.labelNames.size());
+        for (const Name &name : part.labelNames) {
+            ids.push_back(code.labelId(name));
+        }
+
+        uint32_t firstOperand = code.operands.size();
+        uint32_t firstByte = code.bytes.size();
+        for (FlatLine line : part.lines) {
+            if (line.kind == FlatLine::Instruction) {
+                line.first += firstOperand;
+            } else if (line.kind == FlatLine::Data) {
+                line.first += firstByte;
+            } else {
+                line.first = ids[line.first];
+            }
+            code.lines.push_back(line);
+        }
+        for (FlatOperand op : part.operands) {
+            if (op.kind == FlatOperand::Label) {
+                op.value = ids[op.value];
+            }
+            code.operands.push_back(op);
+        }
+        code.bytes.insert(code.bytes.end(), part.bytes.begin(), part.bytes.end());
+    }
+    return code;
+}
+
+/* The flat lines match the lines they were made from one for one, so the
+ * instruction a use comes from can be found to say where it was written.
+ */
+void checkLabels(const FlatCode &code, const std::vector<AsmLine*> &lines, ErrorLogger &errors) {
+    std::vector<bool> defined(code.labelNames.size(), false);
+    for (const FlatLine &line : code.lines) {
+        if (line.kind == FlatLine::Label) {
+            defined[line.first] = true;
+        }
+    }
+
+    std::vector<bool> reported(code.labelNames.size(), false);
+    for (size_t i = 0; i < code.lines.size(); ++i) {
+        const FlatLine &line = code.lines[i];
+        if (line.kind != FlatLine::Instruction) {
+            continue;
+        }
+        for (uint32_t j = line.first; j < line.first + line.count; ++j) {
+            const FlatOperand &op = code.operands[j];
+            if (op.kind != FlatOperand::Label || defined[op.value] || reported[op.value]) {
+                continue;
+            }
+            reported[op.value] = true;
+            const AsmStatement *stmt = static_cast<const AsmStatement*>(lines[i]);
+            errors.add(ErrorLogger::Error, stmt->origin,
+                       "Undefined label " + code.labelNames[op.value].str() + ".");
+        }
+    }
+}
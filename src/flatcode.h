@@ -0,0 +1,95 @@
+#ifndef FLATCODE_H
+#define FLATCODE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/* The finished assembly in the form layout and output work on. Every line
+ * is a record of the same size in one array. An instruction's operands are
+ * a run of one shared operand array and a data line's bytes are a run of
+ * one shared byte array. Labels are numbered in the order they are first
+ * seen, and operands refer to them by number.
+ *
+ * gbuilder.h must be included before this header.
+ */
+
+class FlatOperand {
+public:
+    enum Kind : uint8_t {
+        Constant, Local, Label, Stack
+    };
+
+    FlatOperand()
+    : kind(Constant), isIndirect(false), size(0), value(0)
+    { }
+
+    // the addressing mode, given the size the operand has been given
+    int mode() const {
+        if (kind == Stack) {
+            return 8;
+        }
+        int sizeMode = size == 4 ? 3 : size;
+        if (isIndirect) {
+            return 4 + sizeMode;
+        } else if (kind == Local) {
+            return 8 + sizeMode;
+        }
+        return sizeMode;
+    }
+
+    Kind kind;
+    bool isIndirect;
+    uint8_t size;
+    // the constant, the local's number or the label's number
+    int32_t value;
+};
+
+class FlatLine {
+public:
+    enum Kind : uint8_t {
+        Instruction, Data, Label
+    };
+
+    FlatLine()
+    : kind(Instruction), code(nullptr), first(0), count(0), size(0), pos(0)
+    { }
+
+    Kind kind;
+    const AsmCode *code;
+    // the first operand or data byte and how many there are; for a label,
+    // first is the label's number
+    uint32_t first;
+    uint32_t count;
+    int size;
+    int pos;
+};
+
+class FlatCode {
+public:
+    // the number of a label, given a new one the first time it is seen
+    int labelId(const Name &name);
+    // the number of a label, or -1 if it never appears
+    int findLabel(const Name &name) const;
+    // the encoded length of an instruction with the sizes its operands have
+    int measure(const FlatLine &line) const;
+
+    std::vector<FlatLine> lines;
+    std::vector<FlatOperand> operands;
+    std::vector<unsigned char> bytes;
+    std::vector<Name> labelNames;
+    // where each label was placed, or -1 if it is never defined
+    std::vector<int> labelAddresses;
+
+private:
+    std::unordered_map<Name, int> labelIds;
+};
+
+FlatOperand flattenOperand(AsmOperand *op, FlatCode *code);
+// true if a function or string starts at line i
+bool startsSection(const std::vector<AsmLine*> &lines, size_t i);
+FlatCode flatten(const std::vector<AsmLine*> &lines, int jobs);
+// reports each label that is used but never defined, at its first use
+void checkLabels(const FlatCode &code, const std::vector<AsmLine*> &lines, ErrorLogger &errors);
+
+#endif
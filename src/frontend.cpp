@@ -0,0 +1,99 @@
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "cache.h"
+#include "gbuilder.h"
+#include "parallel.h"
+
+/* Fills in a source unit, from the cache if it has an entry for the file.
+ * A unit that fails to load part way through is replaced by a fresh one
+ * before the file is parsed.
+ */
+static void parseUnit(std::unique_ptr<SourceUnit> &unit, int errorLimit, const UnitCache *cache) {
+    std::string entry;
+    if (cache) {
+        entry = cache->entryFor(unit->fileId);
+        std::unique_ptr<SourceUnit> cached(new SourceUnit(unit->fileId, unit->unitIndex));
+        if (cache->load(entry, *cached)) {
+            unit = std::move(cached);
+            return;
+        }
+    }
+
+    Lexer lexer(unit->errors);
+    lexer.doLex(unit->fileId);
+    unit->tokens = lexer.takeTokens();
+    if (!unit->errors.empty()) {
+        return;
+    }
+
+    Parser parser(unit->errors, unit->gamedata, unit->tokens, errorLimit);
+    parser.doParse();
+    if (cache && unit->errors.empty()) {
+        cache->store(entry, *unit);
+    }
+}
+
+/* Lexes and parses each source unit, using up to jobs threads. Since each
+ * unit only touches its own data the results do not depend on which thread
+ * handled it.
+ */
+void parseSourceUnits(std::vector<std::unique_ptr<SourceUnit> > &units, int jobs,
+                      int errorLimit, const UnitCache *cache) {
+    forEachIndex(units.size(), jobs, [&units, errorLimit, cache](size_t unit, unsigned) {
+        parseUnit(units[unit], errorLimit, cache);
+    });
+}
+
+/* Moves everything from another GameData, normally the results of parsing
+ * a single file, into this one. Global symbols that were already declared
+ * by an earlier unit are reported as errors.
+ */
+void GameData::merge(GameData &other, ErrorLogger &errors) {
+    arena.adopt(other.arena);
+
+    for (SymbolDef *symbol : other.symbols.declared) {
+        SymbolDef *first = symbols.find(symbol->name);
+        if (first) {
+            std::stringstream ss;
+            ss << "symbol "
+               << symbol->name.str()
+               << " already declared at "
+               << first->origin.file() << ':' << first->origin.line() << ':' << first->origin.column()
+               << ".";
+            errors.add(ErrorLogger::Error, symbol->origin, ss.str());
+        } else {
+            symbols.add(symbol);
+        }
+    }
+    other.symbols.clear();
+
+    for (FunctionDef *function : other.functions) {
+        function->args.parent = &symbols;
+        functions.push_back(function);
+    }
+    other.functions.clear();
+
+    strings.merge(other.strings);
+    vocabRaw.insert(other.vocabRaw.begin(), other.vocabRaw.end());
+    unresolved.insert(unresolved.end(), other.unresolved.begin(), other.unresolved.end());
+    other.unresolved.clear();
+}
+
+/* Binds the names each file left unresolved to the globals of the whole
+ * program. Anything still not found is reported where it was used.
+ */
+void GameData::resolveNames(ErrorLogger &errors) {
+    for (const NameUse &use : unresolved) {
+        SymbolDef *symbol = symbols.find(use.value->text);
+        if (symbol) {
+            symbol->bind(*use.value, nullptr);
+        } else {
+            std::stringstream ss;
+            ss << "Undefined symbol " << use.value->text.str() << ".";
+            errors.add(ErrorLogger::Error, use.origin, ss.str());
+        }
+    }
+    unresolved.clear();
+}
@@ -1,20 +1,169 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
 #include <list>
 #include <map>
 #include <memory>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
+/* A location in the source code, stored as the id the SourceManager gave
+ * the file and a byte offset into it. The line and column are only worked
+ * out when something asks for them.
+ */
 class Origin {
 public:
-    Origin(const std::string &file, int line, int column)
-    : file(file), line(line), column(column)
+    Origin()
+    : fileId(0), offset(0)
     { }
+    Origin(uint32_t fileId, uint32_t offset)
+    : fileId(fileId), offset(offset)
+    { }
+
+    const std::string& file() const;
+    int line() const;
+    int column() const;
+
+    uint32_t fileId;
+    uint32_t offset;
+};
+
+/* A read-only window onto source text. The text is not owned by the view;
+ * it normally points into a SourceFile mapping, which must outlive the view.
+ */
+class SourceView {
+public:
+    SourceView()
+    : text(nullptr), length(0)
+    { }
+    SourceView(const char *text, size_t length)
+    : text(text), length(length)
+    { }
+    SourceView(const std::string &text)
+    : text(text.data()), length(text.size())
+    { }
+
+    const char* data() const {
+        return text;
+    }
+    size_t size() const {
+        return length;
+    }
+    char operator[](size_t pos) const {
+        return text[pos];
+    }
+    std::string substr(size_t pos, size_t count) const {
+        return std::string(text + pos, count);
+    }
+private:
+    const char *text;
+    size_t length;
+};
+
+/* A source file loaded into memory. Where possible and asked for, the file
+ * is mapped read-only rather than copied, so the lexer can work on the
+ * file's bytes in place. Otherwise, and for files that cannot be mapped
+ * (pipes, special files), it is read into an owned buffer.
+ */
+class SourceFile {
+public:
+    SourceFile(const std::string &filename, bool mapFile = true);
+    ~SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    const std::string& name() const {
+        return filename;
+    }
+    SourceView view() const {
+        return SourceView(text, length);
+    }
+private:
+    std::string filename;
+    std::string buffer;
+    const char *text;
+    size_t length;
+    bool isMapped;
+};
+
+/* Keeps every file that takes part in the build loaded for as long as the
+ * build runs and gives each one a small id for use in Origins. Each file's
+ * table of line start offsets is built the first time a line or column in
+ * that file is needed.
+ *
+ * File id 0 is "(unknown)". Pseudo-files, such as the name of a compiler
+ * pass, have no text and report every location as line 0, column 0.
+ */
+class SourceManager {
+public:
+    SourceManager();
+
+    // whether files added from now on are mapped rather than copied
+    void setMapFiles(bool map) {
+        mapFiles = map;
+    }
+    uint32_t addFile(const std::string &filename);
+    uint32_t addPseudoFile(const std::string &name);
+    void reload(uint32_t fileId);
+
+    const std::string& name(uint32_t fileId) const;
+    SourceView text(uint32_t fileId) const;
+    void lineAndColumn(const Origin &origin, int &line, int &column);
+private:
+    class Entry {
+    public:
+        std::string name;
+        std::unique_ptr<SourceFile> file;
+        std::vector<uint32_t> lineStarts;
+    };
+    std::vector<Entry> files;
+    bool mapFiles;
+};
 
-    std::string file;
-    int line, column;
+SourceManager& sourceManager();
+
+/* An interned identifier or string. Each distinct spelling is stored once in
+ * a global table and a Name refers to it by a small integer id, so names are
+ * compared and hashed as integers. The default Name is the empty string.
+ */
+class Name {
+public:
+    Name()
+    : id(0)
+    { }
+    Name(const char *text, size_t length);
+    explicit Name(const std::string &text);
+
+    const std::string& str() const;
+    int getId() const {
+        return id;
+    }
+    bool empty() const {
+        return id == 0;
+    }
+    bool operator==(const Name &rhs) const {
+        return id == rhs.id;
+    }
+    bool operator!=(const Name &rhs) const {
+        return id != rhs.id;
+    }
+private:
+    int id;
 };
 
+namespace std {
+    template<> struct hash<Name> {
+        size_t operator()(const Name &name) const {
+            return name.getId();
+        }
+    };
+}
+
+#include "arena.h"
 #include "ast.h"
 
 enum class OperatorType {
@@ -69,19 +218,19 @@ const char* tokenTypeName(TokenType type);
 class Token {
 public:
     Token()
-    : vInteger(0), vFloat(0.0), origin("(no-file)", 0, 0) {
+    : vInteger(0), vFloat(0.0) {
     }
-    Token(const std::string &file, int line, int column, TokenType type)
-    : type(type), vInteger(0), vFloat(0.0), origin(file,line,column) {
+    Token(const Origin &origin, TokenType type)
+    : type(type), vInteger(0), vFloat(0.0), origin(origin) {
     }
 
-    Token(const std::string &file, int line, int column, OperatorType type)
+    Token(const Origin &origin, OperatorType type)
     : type(TokenType::Operator), vInteger(0), vFloat(0.0),
-      opType(type), origin(file,line,column) {
+      opType(type), origin(origin) {
     }
 
     TokenType type;
-    std::string vText;
+    Name vText;
     int vInteger;
     double vFloat;
     OperatorType opType;
@@ -112,6 +261,7 @@ public:
     }
 
     void add(Type type, const Origin &origin, const std::string &message);
+    void append(const ErrorLogger &other);
     std::list<Message>::iterator begin() {
         return errors.begin();
     }
@@ -135,22 +285,62 @@ private:
     int theErrorCount, theWarningCount;
 };
 
+/* The text of every string literal in the program, each kept once. A
+ * literal is referred to by a handle, the interned Name of its text, so the
+ * same text gets the same handle whichever file it appears in. Strings are
+ * listed in the order they were first added.
+ */
+class StringPool {
+public:
+    void add(const Name &handle) {
+        if (known.insert(handle).second) {
+            strings.push_back(handle);
+        }
+    }
+    void merge(const StringPool &other) {
+        for (const Name &handle : other.strings) {
+            add(handle);
+        }
+    }
+    const std::vector<Name>& all() const {
+        return strings;
+    }
+private:
+    std::vector<Name> strings;
+    std::unordered_set<Name> known;
+};
+
+/* A use of a name that had not been declared by the end of its file. It
+ * can only refer to a global declared in another file, and is looked up
+ * once all the files are merged.
+ */
+class NameUse {
+public:
+    NameUse(Value *value, const Origin &origin)
+    : value(value), origin(origin)
+    { }
+
+    // holds the name until it is bound
+    Value *value;
+    Origin origin;
+};
+
 class GameData {
 public:
-    GameData()
-    : nextString(0) {
+    GameData() {
     }
     ~GameData() {
     }
-    std::string addString(const std::string &text);
+    void merge(GameData &other, ErrorLogger &errors);
+    void resolveNames(ErrorLogger &errors);
 
-    std::list<std::shared_ptr<FunctionDef> > functions;
+    // owns every node of the program, from the AST through to assembly
+    Arena arena;
+    std::vector<FunctionDef*> functions;
     std::set<std::string> vocabRaw;
-    std::map<std::string, std::string> stringtable;
+    StringPool strings;
     SymbolTable symbols;
-
-private:
-    int nextString;
+    std::vector<NameUse> unresolved;
 };
 
 class Lexer {
@@ -159,75 +349,98 @@ public:
     : errors(errors) {
     }
 
-    void doLex(const std::string &sourceFile, const std::string &source_text);
+    void doLex(uint32_t fileId);
     const std::vector<Token>& getTokens() const {
         return tokens;
     }
+    std::vector<Token> takeTokens() {
+        return std::move(tokens);
+    }
 private:
+    void doBlockComment();
     void doCharLiteral();
     void doIdentifier();
     void doHexNumber();
+    void doLineComment();
     void doNumber();
     void doOperatorToken(OperatorType type, int length);
+    void doPunctuation();
+    void doQuoted(char quote, const Origin &origin, std::string &text, const char *unterminated);
     void doSimpleToken(TokenType type);
-    void doSimpleToken2(TokenType type);
     void doString();
     void doVocab();
 
-    bool isIdentifier(int c, bool isInitial = false) const;
-    void unescape(const Origin &origin, std::string &text);
 
+    Origin origin() const;
     int here() const;
     int next();
     int peek() const;
-    int prev() const;
 
     ErrorLogger &errors;
     std::set<std::string> vocab;
-    std::string sourceFile;
-    std::string source;
+    uint32_t fileId;
+    SourceView source;
     std::vector<Token> tokens;
     int current;
-    int cLine, cColumn;
 };
 
-class ParserError : public std::runtime_error {
-public:
-    ParserError()
-    : std::runtime_error("Parser Error")
-    { }
-};
 class Parser {
 public:
-    Parser(ErrorLogger &errors, GameData &gamedata, const std::vector<Token> &tokens)
-    : current(0), errors(errors), gamedata(gamedata), tokens(tokens) {
+    // errorLimit is how many errors the file may have before the parser
+    // gives up on it, or 0 for no limit
+    Parser(ErrorLogger &errors, GameData &gamedata, const std::vector<Token> &tokens, int errorLimit = 0)
+    : current(0), errors(errors), gamedata(gamedata), tokens(tokens), errorLimit(errorLimit),
+      curTable(nullptr), curFunction(nullptr), nextLocal(0), usedLocals(0), maxLocals(0) {
     }
 
     void doParse();
 private:
-    void doConstant();
-    std::shared_ptr<FunctionDef> doFunction();
+    /* A use of a name that is not declared in the scope it is used in,
+     * such as a jump to a label further on, a call to a later function or
+     * a global. It is looked up again in the scope it was used in once the
+     * whole file is parsed.
+     */
+    class Fixup {
+    public:
+        Fixup(Value *value, SymbolTable *scope, FunctionDef *function, const Origin &origin)
+        : value(value), scope(scope), function(function), origin(origin)
+        { }
+
+        Value *value;
+        SymbolTable *scope;
+        FunctionDef *function;
+        Origin origin;
+    };
+
+    void bindName(Value *value, const Origin &origin);
+    void resolveFixups();
+    SymbolDef* declareLocal(const Name &name, const Origin &origin, SymbolTable &table);
 
-    std::shared_ptr<StatementDef> doStatement();
-    std::shared_ptr<CodeBlock> doCodeBlock();
+    bool doConstant();
+    FunctionDef* doFunction();
+
+    StatementDef* doStatement();
+    CodeBlock* doCodeBlock();
     bool doLocalsStmt();
-    std::shared_ptr<LabelStmt> doLabel();
-    std::shared_ptr<ReturnDef> doReturn();
-    std::shared_ptr<ExpressionDef> doExpression();
-    std::shared_ptr<ExpressionStmt> doExpressionStmt();
-    std::shared_ptr<Value> doValue();
+    LabelStmt* doLabel();
+    ReturnDef* doReturn();
+    ExpressionDef* doExpression();
+    ExpressionStmt* doExpressionStmt();
+    Value* doValue();
 
-    std::shared_ptr<StatementDef> doAsmBlock();
-    std::shared_ptr<StatementDef> doAsmStatement();
-    std::shared_ptr<AsmOperand> doAsmOperand();
+    StatementDef* doAsmBlock();
+    StatementDef* doAsmStatement();
+    AsmOperand* doAsmOperand();
 
     void synchronize();
-    void expect(TokenType type);
-    void expectAdv(TokenType type);
-    void expect(const std::string &text);
+    void synchronizeTopLevel();
+    void error(const Origin &origin, const std::string &message);
+    bool expect(TokenType type);
+    bool expectAdv(TokenType type);
+    bool expect(const Name &text);
     bool matches(TokenType type);
-    bool matches(const std::string &text);
-    bool symbolExists(const SymbolTable &table, const std::string &name);
+    bool matches(const Name &text);
+    bool symbolExists(const SymbolTable &table, const Name &name, const Origin &origin);
     const Token* here();
     const Token* next();
 
@@ -235,21 +448,83 @@ private:
     ErrorLogger &errors;
     GameData &gamedata;
     const std::vector<Token> &tokens;
+    int errorLimit;
     SymbolTable *curTable;
+    FunctionDef *curFunction;
+    // the frame slot the next local of the current block gets, the slots
+    // taken by the blocks inside it that have ended, and the most slots the
+    // function needs
+    int nextLocal;
+    int usedLocals;
+    int maxLocals;
+    std::vector<Fixup> fixups;
 };
 
+/* The results of lexing and parsing one source file on its own. Each unit
+ * is built independently, so units can be processed in parallel, and then
+ * merged into the program's GameData in project file order.
+ */
+class SourceUnit {
+public:
+    SourceUnit(uint32_t fileId, int unitIndex)
+    : fileId(fileId), unitIndex(unitIndex) {
+    }
+
+    uint32_t fileId;
+    int unitIndex;
+    ErrorLogger errors;
+    std::vector<Token> tokens;
+    GameData gamedata;
+};
+
+class UnitCache;
+void parseSourceUnits(std::vector<std::unique_ptr<SourceUnit> > &units, int jobs,
+                      int errorLimit, const UnitCache *cache);
+
+/* The command line settings that carry through a build. */
+class BuildOptions {
+public:
+    BuildOptions()
+    : showAST(false), showASM(false), showLabels(false), showTokens(false),
+      showReport(false), jobs(1), optimize(1), errorLimit(100)
+    { }
+
+    bool showAST;
+    bool showASM;
+    bool showLabels;
+    bool showTokens;
+    bool showReport;
+    int jobs;
+    int optimize;
+    // errors a file may have before the parser gives up on it; 0 for no limit
+    int errorLimit;
+};
+
+class ProjectFile;
+bool buildProgram(std::vector<std::unique_ptr<SourceUnit> > &units, const ProjectFile *projectFile,
+                  const BuildOptions &options, bool writeImage, ErrorLogger &errors,
+                  std::ostream &status);
+
 class AsmCode {
 public:
-    AsmCode(const char *name, int opcode, int operands, bool relative = false)
-    : name(name), opcode(opcode), operands(operands), relative(relative) {
+    constexpr AsmCode(const char *name, int opcode, int operands, bool relative = false)
+    : name(name), opcode(opcode), operands(operands), relative(relative),
+      width(opcode > 0x3FFF ? 4 : (opcode > 0x7F ? 2 : 1)),
+      encoded(opcode > 0x3FFF ? opcode + 0xC0000000u : (opcode > 0x7F ? opcode + 0x8000u : opcode)) {
     }
 
     const char *name;
     int opcode;
     int operands;
     bool relative;
+    // the opcode as it is written in the game file, and its length in bytes
+    int width;
+    uint32_t encoded;
 };
 
 const AsmCode& opcodeByName(const std::string &name);
 
+// the address of the first line of the game, just past the header
+const int firstLineAddress = 256;
+
 #include "project.h"
@@ -0,0 +1,101 @@
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gbuilder.h"
+
+/* The table of every distinct spelling seen during the build. Spellings are
+ * found through an open addressing index, so looking up a spelling that is
+ * already known does not allocate.
+ *
+ * Files are lexed on several threads at once, so adding to the table is
+ * done under a lock. Spellings are stored in fixed size chunks that never
+ * move once allocated, which lets get() read a spelling without the lock
+ * while other threads add new ones.
+ */
+class InternTable {
+public:
+    InternTable()
+    : count(0), index(1024, -1) {
+        intern("", 0);
+    }
+
+    int intern(const char *text, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t mask = index.size() - 1;
+        size_t slot = hash(text, length) & mask;
+        while (index[slot] >= 0) {
+            const std::string &known = get(index[slot]);
+            if (known.size() == length && known.compare(0, length, text, length) == 0) {
+                return index[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        int id = count;
+        std::unique_ptr<std::string[]> &chunk = chunks[id / chunkSize];
+        if (!chunk) {
+            chunk.reset(new std::string[chunkSize]);
+        }
+        chunk[id % chunkSize].assign(text, length);
+        ++count;
+        index[slot] = id;
+        if (count * 2 > index.size()) {
+            grow();
+        }
+        return id;
+    }
+
+    const std::string& get(int id) const {
+        return chunks[id / chunkSize][id % chunkSize];
+    }
+
+private:
+    static const unsigned chunkSize = 4096;
+    static const unsigned maxChunks = 65536;
+
+    static size_t hash(const char *text, size_t length) {
+        size_t h = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            h = (h ^ static_cast<unsigned char>(text[i])) * 16777619u;
+        }
+        return h;
+    }
+
+    void grow() {
+        std::vector<int> newIndex(index.size() * 2, -1);
+        size_t mask = newIndex.size() - 1;
+        for (unsigned id = 0; id < count; ++id) {
+            const std::string &text = get(id);
+            size_t slot = hash(text.data(), text.size()) & mask;
+            while (newIndex[slot] >= 0) {
+                slot = (slot + 1) & mask;
+            }
+            newIndex[slot] = id;
+        }
+        index.swap(newIndex);
+    }
+
+    std::mutex mutex;
+    std::unique_ptr<std::string[]> chunks[maxChunks];
+    unsigned count;
+    std::vector<int> index;
+};
+
+static InternTable& internTable() {
+    static InternTable table;
+    return table;
+}
+
+Name::Name(const char *text, size_t length)
+: id(internTable().intern(text, length)) {
+}
+
+Name::Name(const std::string &text)
+: id(internTable().intern(text.data(), text.size())) {
+}
+
+const std::string& Name::str() const {
+    return internTable().get(id);
+}
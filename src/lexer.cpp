@@ -1,7 +1,9 @@
+#include <cstring>
 #include <sstream>
 #include <string>
 
 #include "gbuilder.h"
+#include "scan.h"
 
 const char* operatorName(OperatorType type) {
     switch(type) {
@@ -57,60 +59,183 @@ const char* tokenTypeName(TokenType type) {
     }
 }
 
-static const char *reservedWords[] = {
+/* ************************************************************ *
+ * CHARACTER CLASSES                                            *
+ * ************************************************************ */
+
+// The class of each byte decides which lexer state handles a token starting
+// with it. Classes are assigned without reference to the C locale; bytes
+// above 127 are never part of a token outside of strings and comments.
+enum CharClass : unsigned char {
+    ccOther, ccEnd, ccSpace, ccIdentStart, ccDigit, ccPunct,
+    ccQuote, ccApostrophe, ccDollar
+};
+
+constexpr bool isAsciiAlpha(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+constexpr bool isAsciiDigit(int c) {
+    return c >= '0' && c <= '9';
+}
+constexpr bool isAsciiHexDigit(int c) {
+    return isAsciiDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+constexpr CharClass classOf(int c) {
+    return c == 0 ? ccEnd
+         : (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f') ? ccSpace
+         : (isAsciiAlpha(c) || c == '_') ? ccIdentStart
+         : isAsciiDigit(c) ? ccDigit
+         : c == '"' ? ccQuote
+         : c == '\'' ? ccApostrophe
+         : c == '$' ? ccDollar
+         : (c == '{' || c == '}' || c == '(' || c == ')' || c == ';' || c == ','
+             || c == '?' || c == '+' || c == '-' || c == '*' || c == '/' || c == '='
+             || c == '%' || c == '!' || c == '^' || c == '.' || c == '<' || c == '>'
+             || c == '&' || c == '|') ? ccPunct
+         : ccOther;
+}
+
+// bit flags for the characters that can continue a token once it has started
+enum CharFlags : unsigned char {
+    cfIdent = 1, cfDigit = 2, cfHexDigit = 4
+};
+
+constexpr unsigned char flagsOf(int c) {
+    return (isAsciiAlpha(c) || isAsciiDigit(c) || c == '_' ? cfIdent : 0)
+         | (isAsciiDigit(c) ? cfDigit : 0)
+         | (isAsciiHexDigit(c) ? cfHexDigit : 0);
+}
+
+#define CHAR_TABLE_4(f, n)  f(n), f(n + 1), f(n + 2), f(n + 3)
+#define CHAR_TABLE_16(f, n) CHAR_TABLE_4(f, n), CHAR_TABLE_4(f, n + 4), CHAR_TABLE_4(f, n + 8), CHAR_TABLE_4(f, n + 12)
+#define CHAR_TABLE_64(f, n) CHAR_TABLE_16(f, n), CHAR_TABLE_16(f, n + 16), CHAR_TABLE_16(f, n + 32), CHAR_TABLE_16(f, n + 48)
+#define CHAR_TABLE(f)       { CHAR_TABLE_64(f, 0), CHAR_TABLE_64(f, 64), CHAR_TABLE_64(f, 128), CHAR_TABLE_64(f, 192) }
+
+static constexpr CharClass charClasses[256] = CHAR_TABLE(classOf);
+static constexpr unsigned char charFlags[256] = CHAR_TABLE(flagsOf);
+
+#undef CHAR_TABLE
+#undef CHAR_TABLE_64
+#undef CHAR_TABLE_16
+#undef CHAR_TABLE_4
+
+
+/* ************************************************************ *
+ * RESERVED WORDS                                               *
+ * ************************************************************ */
+
+// Reserved words are found with a perfect hash: each word sits in the slot
+// given by keywordHash, so a lookup is one hash and one comparison. The
+// placement of every word is checked when compiling.
+constexpr unsigned keywordHash(const char *word, unsigned length) {
+    return (length + static_cast<unsigned char>(word[1])
+                   + 4 * static_cast<unsigned char>(word[length - 1])) & 7;
+}
+
+static constexpr const char *keywordTable[8] = {
+    nullptr,
+    nullptr,
     "asm",
-    "constant",
+    "return",
+    "local",
     "function",
     "label",
-    "local",
-    "return"
+    "constant"
 };
-static bool isReservedWord(const std::string &word) {
-    for (const char *test : reservedWords) {
-        if (test && word == test) {
-            return true;
-        }
+
+constexpr unsigned constLength(const char *text) {
+    return *text ? 1 + constLength(text + 1) : 0;
+}
+constexpr bool keywordsPlaced(unsigned slot = 0) {
+    return slot >= 8
+        || ((keywordTable[slot] == nullptr
+             || keywordHash(keywordTable[slot], constLength(keywordTable[slot])) == slot)
+            && keywordsPlaced(slot + 1));
+}
+static_assert(keywordsPlaced(), "reserved word is not in its hash slot");
+
+static bool isReservedWord(const char *word, unsigned length) {
+    if (length < 3) {
+        return false;
     }
-    return false;
+    const char *keyword = keywordTable[keywordHash(word, length)];
+    return keyword && strncmp(keyword, word, length) == 0 && keyword[length] == 0;
 }
 
-void Lexer::doLex(const std::string &sourceFile, const std::string &source_text) {
-    this->sourceFile = sourceFile;
-    source = source_text;
-    Token t;
 
-    cLine = cColumn = 1;
-    current = 0;
+/* ************************************************************ *
+ * LEXER                                                        *
+ * ************************************************************ */
 
-    while (here()) {
-        if (isspace(here())) {
-            next();
+void Lexer::doLex(uint32_t fileId) {
+    this->fileId = fileId;
+    source = sourceManager().text(fileId);
+    current = 0;
 
-        } else if (here() == '/' && peek() == '/') {
-            while (here() != '\n' && here() != 0) next();
-        } else if (here() == '/' && peek() == '*') {
-            int sline = cLine, scol = cColumn;
-            while (here() != '/' || prev() != '*') {
-                next();
-                if (here() == 0) {
-                    errors.add(ErrorLogger::Error, Origin(sourceFile, sline, scol), "unterminated block comment /* */");
-                    break;
+    const int size = source.size();
+    while (current < size) {
+        unsigned char c = source[current];
+        switch(charClasses[c]) {
+            case ccSpace:
+                current = scanSpaces(source.data(), current, size);
+                break;
+            case ccIdentStart:
+                doIdentifier();
+                break;
+            case ccDigit:
+                if (c == '0' && (peek() == 'x' || peek() == 'X')) {
+                    doHexNumber();
+                } else {
+                    doNumber();
                 }
+                break;
+            case ccPunct:
+                doPunctuation();
+                break;
+            case ccQuote:
+                doString();
+                break;
+            case ccApostrophe:
+                doCharLiteral();
+                break;
+            case ccDollar:
+                doVocab();
+                break;
+            case ccEnd:
+            case ccOther: {
+                std::stringstream ss;
+                ss << "Unexpected character '" << (char)c << "' (" << (int)c << ").";
+                errors.add(ErrorLogger::Error, origin(), ss.str());
+                ++current;
+                break; }
+        }
+    }
+    doSimpleToken(EndOfFile);
+}
+
+void Lexer::doPunctuation() {
+    switch(here()) {
+        case '{':   doSimpleToken(OpenBrace);   break;
+        case '}':   doSimpleToken(CloseBrace);  break;
+        case '(':   doSimpleToken(OpenParan);   break;
+        case ')':   doSimpleToken(CloseParan);  break;
+        case ';':   doSimpleToken(Semicolon);   break;
+        case ',':   doSimpleToken(Comma);       break;
+        case '?':   doSimpleToken(Question);    break;
+
+        case '/':
+            if (peek() == '/') {
+                doLineComment();
+            } else if (peek() == '*') {
+                doBlockComment();
+            } else if (peek() == '=') {
+                doOperatorToken(OperatorType::DivideEquals, 2);
+            } else {
+                doOperatorToken(OperatorType::Divide, 1);
             }
-            next();
-
-        } else if (here() == '{') {
-            doSimpleToken(OpenBrace);
-        } else if (here() == '}') {
-            doSimpleToken(CloseBrace);
-        } else if (here() == '(') {
-            doSimpleToken(OpenParan);
-        } else if (here() == ')') {
-            doSimpleToken(CloseParan);
-        } else if (here() == ';') {
-            doSimpleToken(Semicolon);
-
-        } else if (here() == '+') {
+            break;
+        case '+':
             if (peek() == '=') {
                 doOperatorToken(OperatorType::PlusEquals, 2);
             } else if (peek() == '+') {
@@ -118,7 +243,8 @@ void Lexer::doLex(const std::string &sourceFile, const std::string &source_text)
             } else {
                 doOperatorToken(OperatorType::Plus, 1);
             }
-        } else if (here() == '-') {
+            break;
+        case '-':
             if (peek() == '=') {
                 doOperatorToken(OperatorType::MinusEquals, 2);
             } else if (peek() == '-') {
@@ -126,165 +252,195 @@ void Lexer::doLex(const std::string &sourceFile, const std::string &source_text)
             } else {
                 doOperatorToken(OperatorType::Minus, 1);
             }
-        } else if (here() == '/') {
-            if (peek() == '=') {
-                doOperatorToken(OperatorType::DivideEquals, 2);
-            } else {
-                doOperatorToken(OperatorType::Divide, 1);
-            }
-        } else if (here() == '*') {
+            break;
+        case '*':
             if (peek() == '=') {
                 doOperatorToken(OperatorType::MultiplyEquals, 2);
             } else {
                 doOperatorToken(OperatorType::Multiply, 1);
             }
-        } else if (here() == '=') {
+            break;
+        case '=':
             if (peek() == '=') {
                 doOperatorToken(OperatorType::Equals, 2);
             } else {
                 doSimpleToken(Assignment);
             }
-        } else if (here() == '%') {
-                doOperatorToken(OperatorType::Modulus, 1);
-        } else if (here() == '!') {
+            break;
+        case '%':
+            doOperatorToken(OperatorType::Modulus, 1);
+            break;
+        case '!':
             if (peek() == '=') {
                 doOperatorToken(OperatorType::NotEquals, 2);
             } else {
                 doOperatorToken(OperatorType::Not, 1);
             }
-        } else if (here() == '^') {
+            break;
+        case '^':
             doOperatorToken(OperatorType::Power, 1);
-        } else if (here() == '.') {
-                doOperatorToken(OperatorType::Property, 1);
-
-        } else if (here() == '<') {
+            break;
+        case '.':
+            doOperatorToken(OperatorType::Property, 1);
+            break;
+        case '<':
             if (peek() == '=') {
                 doOperatorToken(OperatorType::LessThanOrEquals, 2);
             } else {
                 doOperatorToken(OperatorType::LessThan, 1);
             }
-        } else if (here() == '>') {
+            break;
+        case '>':
             if (peek() == '=') {
                 doOperatorToken(OperatorType::GreaterThanOrEquals, 2);
             } else {
                 doOperatorToken(OperatorType::GreaterThan, 1);
             }
-        } else if (here() == ',') {
-            doSimpleToken(Comma);
-        } else if (here() == '?') {
-            doSimpleToken(Question);
-
-        } else if (here() == '&' && peek() == '&') {
-            doOperatorToken(OperatorType::LogicalAnd, 2);
-        } else if (here() == '|' && peek() == '|') {
-                doOperatorToken(OperatorType::LogicalOr, 2);
-
-        } else if (isIdentifier(here(), true)) {
-            doIdentifier();
-        } else if (here() == '0' && (peek() == 'x' || peek() == 'X')) {
-            doHexNumber();
-        } else if (isdigit(here())) {
-            doNumber();
-        } else if (here() == '"') {
-            doString();
-        } else if (here() == '\'') {
-            doCharLiteral();
-        } else if (here() == '$') {
-            doVocab();
-        } else {
-            std::stringstream ss;
-            ss << "Unexpected character '" << (char)here() << "' (" << here() << ").";
-            errors.add(ErrorLogger::Error, Origin(sourceFile, cLine, cColumn), ss.str());
-            next();
+            break;
+        case '&':
+        case '|': {
+            int c = here();
+            if (peek() == c) {
+                doOperatorToken(c == '&' ? OperatorType::LogicalAnd : OperatorType::LogicalOr, 2);
+            } else {
+                std::stringstream ss;
+                ss << "Unexpected character '" << (char)c << "' (" << c << ").";
+                errors.add(ErrorLogger::Error, origin(), ss.str());
+                next();
+            }
+            break; }
+    }
+}
+
+void Lexer::doLineComment() {
+    current = scanFor(source.data(), current, source.size(), '\n', '\n');
+}
+
+void Lexer::doBlockComment() {
+    Origin start = origin();
+    size_t pos = current + 2;
+    while (true) {
+        pos = scanFor(source.data(), pos, source.size(), '*', '*');
+        if (pos + 1 >= source.size()) {
+            break;
+        }
+        if (source[pos + 1] == '/') {
+            current = pos + 2;
+            return;
         }
+        ++pos;
     }
-    doSimpleToken(EndOfFile);
+    errors.add(ErrorLogger::Error, start, "unterminated block comment /* */");
+    current = source.size();
 }
 
 void Lexer::doHexNumber() {
-    Token t(sourceFile, cLine, cColumn, Integer);
-    int start = current;
+    Token t(origin(), Integer);
     next(); next();
 
-    while (isxdigit(here())) {
+    int start = current;
+    unsigned long long value = 0;
+    while (charFlags[here()] & cfHexDigit) {
+        int c = here();
+        int digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+        value = (value << 4) | digit;
+        if (value > 0xFFFFFFFFULL) {
+            value = 0x100000000ULL;
+        }
         next();
     }
 
-    const std::string &text = source.substr(start, current-start);
-    t.vInteger = std::stoi(text, nullptr, 16);
+    if (current == start) {
+        errors.add(ErrorLogger::Error, t.origin, "hexadecimal literal has no digits");
+    } else if (value > 0xFFFFFFFFULL) {
+        errors.add(ErrorLogger::Error, t.origin, "integer literal too large");
+    }
+    t.vInteger = static_cast<int>(static_cast<uint32_t>(value));
     tokens.push_back(std::move(t));
 }
 
 void Lexer::doNumber() {
-    Token t(sourceFile, cLine, cColumn, Integer);
+    Token t(origin(), Integer);
 
-    bool isFloat = false;
+    // digits are gathered as one integer whatever side of the decimal point
+    // they fall on; fractionDigits says where the point goes
     int start = current;
-    while (isdigit(here())) {
+    unsigned long long value = 0;
+    int digits = 0, fractionDigits = 0;
+    while (charFlags[here()] & cfDigit) {
+        if (digits < 19) {
+            value = value * 10 + (here() - '0');
+        }
+        ++digits;
         next();
     }
-    if (here() == '.') {
-        next();
-        isFloat = true;
-        while (isdigit(here())) {
-            next();
+
+    if (here() != '.') {
+        if (digits > 10 || value > 0xFFFFFFFFULL) {
+            errors.add(ErrorLogger::Error, t.origin, "integer literal too large");
+        }
+        t.vInteger = static_cast<int>(static_cast<uint32_t>(value));
+        tokens.push_back(std::move(t));
+        return;
+    }
+
+    next();
+    while (charFlags[here()] & cfDigit) {
+        if (digits < 19) {
+            value = value * 10 + (here() - '0');
+            ++fractionDigits;
         }
+        ++digits;
+        next();
     }
 
-    const std::string &text = source.substr(start, current-start);
-    if (isFloat) {
-        t.type = Float;
-        t.vFloat = std::stod(text);
+    // Both the digits and the power of ten are exact as doubles in this
+    // range, so one division gives the correctly rounded result. Anything
+    // else is rare enough to hand to the library.
+    static const double powersOfTen[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    t.type = Float;
+    if (digits <= 19 && value < (1ULL << 53)) {
+        t.vFloat = value / powersOfTen[fractionDigits];
     } else {
-        t.vInteger = std::stoi(text, nullptr, 10);
+        t.vFloat = std::stod(source.substr(start, current-start));
     }
     tokens.push_back(std::move(t));
 }
 
 void Lexer::doIdentifier() {
-    Token t(sourceFile, cLine, cColumn, Identifier);
+    Token t(origin(), Identifier);
 
     int start = current;
-    while (isIdentifier(here())) {
-        next();
+    ++current;
+    while (current < (int)source.size() && (charFlags[static_cast<unsigned char>(source[current])] & cfIdent)) {
+        ++current;
     }
 
-    t.vText = source.substr(start, current-start);
-    if (isReservedWord(t.vText)) {
+    const char *text = source.data() + start;
+    t.vText = Name(text, current - start);
+    if (isReservedWord(text, current - start)) {
         t.type = ReservedWord;
     }
     tokens.push_back(std::move(t));
 }
 
 void Lexer::doOperatorToken(OperatorType type, int length) {
-    tokens.push_back(Token(sourceFile, cLine, cColumn, type));
-    while (length > 0) --length;
+    tokens.push_back(Token(origin(), type));
+    current += length;
 }
 void Lexer::doSimpleToken(TokenType type) {
-    tokens.push_back(Token(sourceFile, cLine, cColumn, type));
-    next();
-}
-
-void Lexer::doSimpleToken2(TokenType type) {
-    tokens.push_back(Token(sourceFile, cLine, cColumn, type));
-    next();
+    tokens.push_back(Token(origin(), type));
     next();
 }
 
 void Lexer::doCharLiteral() {
-    Token t(sourceFile, cLine, cColumn, Integer);
+    Token t(origin(), Integer);
 
-    next();
-    int start = current;
-    while (here() != 0 && (here() != '\'' || prev() == '\\')) {
-        next();
-        if (here() == 0) {
-            errors.add(ErrorLogger::Error, t.origin, "unterminated character literal");
-        }
-    }
-
-    std::string rawText = source.substr(start, current-start);
-    unescape(t.origin, rawText);
+    std::string rawText;
+    doQuoted('\'', t.origin, rawText, "unterminated character literal");
     if (rawText.size() == 0) {
         errors.add(ErrorLogger::Error, t.origin, "empty character literal");
     } else {
@@ -294,119 +450,104 @@ void Lexer::doCharLiteral() {
         t.vInteger = rawText[0];
     }
     tokens.push_back(std::move(t));
-    next();
 }
 
 void Lexer::doString() {
-    Token t(sourceFile, cLine, cColumn, String);
+    Token t(origin(), String);
 
-    next();
-    int start = current;
-    while (here() != 0 && (here() != '"' || prev() == '\\')) {
-        next();
-        if (here() == 0) {
-            errors.add(ErrorLogger::Error, t.origin, "unterminated string");
-        }
+    std::string text;
+    doQuoted('"', t.origin, text, "unterminated string");
+    if (scanNonAscii(text.data(), 0, text.size()) < text.size()
+            && !validUtf8(text.data(), text.size())) {
+        errors.add(ErrorLogger::Error, t.origin, "string is not valid UTF-8");
     }
-
-    t.vText = source.substr(start, current-start);
-    unescape(t.origin, t.vText);
+    t.vText = Name(text);
     tokens.push_back(std::move(t));
-    next();
 }
 
 void Lexer::doVocab() {
-    Token t(sourceFile, cLine, cColumn, Vocab);
-
-    next();
-    int start = current;
-    while (here() != 0 && here() != '$') {
-        next();
-        if (here() == 0) {
-            errors.add(ErrorLogger::Error, t.origin, "unterminated vocab word");
-        }
+    Token t(origin(), Vocab);
+
+    int start = current + 1;
+    size_t end = scanFor(source.data(), start, source.size(), '$', '$');
+    bool terminated = end < source.size();
+    if (!terminated) {
+        errors.add(ErrorLogger::Error, t.origin, "unterminated vocab word");
+        end = source.size();
     }
 
-    t.vText = source.substr(start, current-start);
-    vocab.insert(t.vText);
+    t.vText = Name(source.data() + start, end - start);
+    vocab.insert(t.vText.str());
     tokens.push_back(std::move(t));
-    next();
+    // with no closing $ there is nothing after the word to step over
+    current = terminated ? end + 1 : end;
 }
 
-bool Lexer::isIdentifier(int c, bool isInitial) const {
-    if (isalpha(c) || c == '_') {
-        return true;
-    }
-    if (!isInitial && isdigit(c)) {
-        return true;
-    }
-    return false;
-}
-
-void Lexer::unescape(const Origin &origin, std::string &text) {
-    for (unsigned i = 0; i < text.size(); ++i) {
-        if (text[i] != '\\') {
-            continue;
+/* Reads a quoted literal starting at the opening quote, unescaping it into
+ * text as it goes, and leaves current just past the closing quote. The text
+ * between escapes is copied a run at a time.
+ */
+void Lexer::doQuoted(char quote, const Origin &origin, std::string &text, const char *unterminated) {
+    const char *data = source.data();
+    size_t size = source.size();
+    size_t pos = current + 1;
+
+    while (true) {
+        size_t found = scanFor(data, pos, size, quote, '\\');
+        text.append(data + pos, found - pos);
+        if (found + 1 >= size && (found >= size || data[found] != quote)) {
+            errors.add(ErrorLogger::Error, origin, unterminated);
+            current = size;
+            return;
         }
-
-        if (i + 1 >= text.size()) {
-            errors.add(ErrorLogger::Error, origin, "incomplete escape at end of string");
-            continue;
+        if (data[found] == quote) {
+            current = found + 1;
+            return;
         }
 
-        switch(text[i+1]) {
+        switch(data[found + 1]) {
             case '\\':
             case '\'':
             case '"':
-                text[i] = text[i+1];
+                text += data[found + 1];
                 break;
             case 'n':
-                text[i] = '\n';
+                text += '\n';
                 break;
             case 't':
-                text[i] = '\t';
+                text += '\t';
                 break;
             default:
                 errors.add(ErrorLogger::Error, origin, "unknown string escape");
-                text[i] = '?';
+                text += '?';
                 break;
         }
-        text.erase(i+1, 1);
+        pos = found + 2;
     }
 }
 
+Origin Lexer::origin() const {
+    return Origin(fileId, current);
+}
+
 int Lexer::here() const {
-    if (current < source.size()) {
-        return source[current];
+    if (current < (int)source.size()) {
+        return static_cast<unsigned char>(source[current]);
     } else {
         return 0;
     }
 }
 
 int Lexer::next() {
-    if (current < source.size()) {
+    if (current < (int)source.size()) {
         ++current;
-        ++cColumn;
     }
-    int c = here();
-    if (c == '\n') {
-        cColumn = 0;
-        ++cLine;
-    }
-    return c;
+    return here();
 }
 
 int Lexer::peek() const {
-    if (current + 1 < source.size()) {
-        return source[current + 1];
-    } else {
-        return 0;
-    }
-}
-
-int Lexer::prev() const {
-    if (current - 1 > 0) {
-        return source[current - 1];
+    if (current + 1 < (int)source.size()) {
+        return static_cast<unsigned char>(source[current + 1]);
     } else {
         return 0;
     }
@@ -1,135 +1,219 @@
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <iterator>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include "cache.h"
+#include "daemon.h"
 #include "gbuilder.h"
-
-void printAST(GameData &gd);
-void dump_asm(std::vector<std::shared_ptr<AsmLine> > lines);
-void doFirstPass(GameData &gd, ErrorLogger &errors);
-std::vector<std::shared_ptr<AsmLine> > buildAsm(GameData &gd);
-void build_game(GameData &gamedata, std::vector<std::shared_ptr<AsmLine> > lines, const ProjectFile *projectFile, bool dumpLabels);
-void dump_tokens(const std::vector<Token> &tokens);
-
-
-std::string GameData::addString(const std::string &text) {
-    std::stringstream ss;
-    ss << "__str_" << nextString;
-    ++nextString;
-    stringtable[ss.str()] = text;
-    symbols.add(new SymbolDef(ss.str(), SymbolDef::String));
-    return ss.str();
-}
-
-
-void showErrors(ErrorLogger &errors) {
+#include "flatcode.h"
+
+void printAST(GameData &gd, std::ostream &out);
+void dump_asm(const FlatCode &code, std::ostream &out);
+std::vector<AsmLine*> buildAsm(GameData &gd, int jobs);
+void optimizeControlFlow(GameData &gamedata, std::vector<AsmLine*> &lines, bool showReport,
+                         std::ostream &out);
+void peephole(GameData &gamedata, std::vector<AsmLine*> &lines, int level, bool showReport,
+              std::ostream &out);
+void stripUnreachable(std::vector<AsmLine*> &lines, const std::vector<std::string> &exports,
+                      ErrorLogger &errors, bool showReport, std::ostream &out);
+void placeStrings(GameData &gamedata, std::vector<AsmLine*> &lines, bool compress, bool showReport,
+                  std::ostream &out);
+bool build_game(GameData &gamedata, FlatCode &code, const ProjectFile *projectFile, bool dumpLabels,
+                std::ostream &status);
+void dump_tokens(const std::vector<Token> &tokens, std::ostream &out);
+
+
+void showErrors(ErrorLogger &errors, std::ostream &status) {
     for (auto m : errors) {
         std::cerr << m.format() << "\n";
     }
-    std::cout << errors.count() << " error(s) occured.\n";
+    status << errors.errorCount() << " error(s) occured.\n";
 }
 
-std::string readFile(const std::string &file) {
-    std::ifstream inf(file);
-    if (!inf) {
-        throw std::runtime_error("Could not open file.");
+/* Everything after parsing: merges the units into one program, resolves
+ * it and, if asked to, builds the game file. The units are used up. Dumps
+ * and reports go to status, which is never where the game file goes.
+ */
+bool buildProgram(std::vector<std::unique_ptr<SourceUnit> > &units, const ProjectFile *pf,
+                  const BuildOptions &options, bool writeImage, ErrorLogger &errors,
+                  std::ostream &status) {
+    GameData gamedata;
+    for (auto &unit : units) {
+        if (options.showTokens) {
+            dump_tokens(unit->tokens, status);
+        }
+        errors.append(unit->errors);
+        gamedata.merge(unit->gamedata, errors);
+    }
+    units.clear();
+    if (!errors.empty()) {
+        return false;
+    }
+
+    gamedata.resolveNames(errors);
+    if (options.showAST) printAST(gamedata, status);
+    if (!errors.empty()) {
+        return false;
+    }
+    if (!writeImage) {
+        return true;
+    }
+
+    auto asmlist = buildAsm(gamedata, options.jobs);
+    if (options.optimize >= 1) {
+        optimizeControlFlow(gamedata, asmlist, options.showReport, status);
+    }
+    peephole(gamedata, asmlist, options.optimize, options.showReport, status);
+    if (options.optimize >= 1) {
+        stripUnreachable(asmlist, pf->exports, errors, options.showReport, status);
+        if (!errors.empty()) {
+            return false;
+        }
+    }
+    placeStrings(gamedata, asmlist, pf->compressStrings, options.showReport, status);
+    FlatCode code = flatten(asmlist, options.jobs);
+    checkLabels(code, asmlist, errors);
+    if (!errors.empty()) {
+        return false;
+    }
+    if (options.showASM) dump_asm(code, status);
+    if (!build_game(gamedata, code, pf, options.showLabels, status)) {
+        errors.add(ErrorLogger::Error, Origin(), "could not write game file " + pf->outputFile + ".");
+        return false;
     }
-    std::string content( (std::istreambuf_iterator<char>(inf)),
-                         std::istreambuf_iterator<char>() );
-    return content;
+    return true;
 }
 
 int main(int argc, char **argv) {
     ErrorLogger errors;
-    GameData gamedata;
-    bool showAST = false;
-    bool showASM = false;
-    bool showLabels = false;
-    bool showTokens = false;
-
-    if (argc < 2) {
-        std::cerr << "USAGE: gbuilder <project-file> [-ast] [-asm]\n";
-        return 1;
-    }
-    for (int i = 2; i < argc; ++i) {
+    BuildOptions options;
+    const char *projectFile = nullptr;
+    bool daemon = false;
+    const char *request = nullptr;
+    std::string socketPath;
+    options.jobs = std::thread::hardware_concurrency();
+
+    for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-ast") == 0) {
-            showAST = true;
+            options.showAST = true;
         } else if (strcmp(argv[i], "-asm") == 0) {
-            showASM = true;
+            options.showASM = true;
         } else if (strcmp(argv[i], "-labels") == 0) {
-            showLabels = true;
+            options.showLabels = true;
         } else if (strcmp(argv[i], "-tokens") == 0) {
-            showTokens = true;
+            options.showTokens = true;
+        } else if (strcmp(argv[i], "-report") == 0) {
+            options.showReport = true;
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            if (argv[i][2] < '0' || argv[i][2] > '2' || argv[i][3] != 0) {
+                std::cerr << "Optimization level must be -O0, -O1 or -O2\n";
+                return 1;
+            }
+            options.optimize = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+                std::cerr << "-j requires a number of jobs\n";
+                return 1;
+            }
+            options.jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-errors") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
+                std::cerr << "-errors requires a number of errors, or 0 for no limit\n";
+                return 1;
+            }
+            options.errorLimit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            daemon = true;
+        } else if (strcmp(argv[i], "--request") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "--request requires build, check or stop\n";
+                return 1;
+            }
+            request = argv[++i];
+        } else if (strcmp(argv[i], "--socket") == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "--socket requires a path\n";
+                return 1;
+            }
+            socketPath = argv[++i];
+        } else if (argv[i][0] != '-' && projectFile == nullptr) {
+            projectFile = argv[i];
         } else {
             std::cerr << "Unrecognized argument " << argv[i] << "\n";
             return 1;
         }
     }
+    if (projectFile == nullptr) {
+        std::cerr << "USAGE: gbuilder <project-file> [-ast] [-asm] [-errors N] [-j N] [-O0|-O1|-O2] [-report]\n";
+        std::cerr << "       gbuilder --daemon <project-file> [--socket <path>]\n";
+        std::cerr << "       gbuilder --request build|check|stop <project-file> [--socket <path>]\n";
+        return 1;
+    }
+    if (socketPath.empty()) {
+        socketPath = std::string(projectFile) + ".sock";
+    }
+    if (request) {
+        return sendRequest(socketPath, request);
+    }
+    if (daemon) {
+        return runDaemon(projectFile, socketPath, options);
+    }
 
 
-    ProjectFile *pf = load_project(argv[1]);
+    ProjectFile *pf = load_project(projectFile);
+    if (!pf) {
+        return 1;
+    }
     if (pf->sourceFiles.empty()) {
         std::cerr << "No source files specified!\n";
         delete pf;
         return 1;
     }
-    std::cout << "Input files:";
+    // keep standard output clear when the game file is being sent there
+    std::ostream &status = pf->outputFile == "-" ? std::cerr : std::cout;
+    status << "Input files:";
     for (const std::string &file : pf->sourceFiles) {
-        std::cout << ' ' << file;
+        status << ' ' << file;
     }
-    std::cout << "\nTarget: " << pf->outputFile << "\n";
+    status << "\nTarget: " << pf->outputFile << "\n";
 
 
-    Lexer lexer(errors);
+    std::vector<std::unique_ptr<SourceUnit> > units;
     for (const std::string &filename : pf->sourceFiles) {
-        std::string source;
+        uint32_t fileId;
         try {
-            source = readFile(filename);
+            fileId = sourceManager().addFile(filename);
         } catch (std::runtime_error &e) {
             std::cerr << "An error occured while trying to read the file \"" << filename << "\".\n";
             delete pf;
             return 1;
         }
-        lexer.doLex(filename, source);
-
-        if (!errors.empty()) {
-            showErrors(errors);
-            delete pf;
-            return 1;
-        }
+        units.push_back(std::unique_ptr<SourceUnit>(new SourceUnit(fileId, units.size())));
     }
 
-    if (showTokens) {
-        dump_tokens(lexer.getTokens());
-    }
-
-    Parser parser(errors, gamedata, lexer.getTokens());
-    parser.doParse();
-    if (!errors.empty()) {
-        showErrors(errors);
-        delete pf;
-        return 1;
+    std::unique_ptr<UnitCache> cache;
+    if (!pf->cacheDirectory.empty()) {
+        try {
+            cache.reset(new UnitCache(pf->cacheDirectory));
+        } catch (std::runtime_error &e) {
+            std::cerr << "Could not use cache directory \"" << pf->cacheDirectory << "\"; continuing without it.\n";
+        }
     }
 
-    doFirstPass(gamedata, errors);
-    if (showAST) printAST(gamedata);
-    if (!errors.empty()) {
-        showErrors(errors);
+    parseSourceUnits(units, options.jobs, options.errorLimit, cache.get());
+    if (!buildProgram(units, pf, options, true, errors, status)) {
+        showErrors(errors, status);
         delete pf;
         return 1;
     }
 
-
-    auto asmlist = buildAsm(gamedata);
-    if (showASM) dump_asm(asmlist);
-    build_game(gamedata, asmlist, pf, showLabels);
-
     delete pf;
-    std::cout << "Success!\n";
+    status << "Success!\n";
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,54 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* Spreads independent pieces of work over several threads. Pieces are
+ * handed out one at a time from a shared counter, so a thread that gets
+ * through its pieces quickly goes on to take more, and no thread sits idle
+ * while work remains. Callers keep each piece's results separate and put
+ * them together in order afterwards, so what comes out never depends on
+ * which thread did what.
+ */
+
+// the number of threads forEachIndex uses for count pieces of work
+inline unsigned workerCount(size_t count, int jobs) {
+    size_t threadCount = jobs > 1 ? jobs : 1;
+    if (threadCount > count) {
+        threadCount = count;
+    }
+    return threadCount > 0 ? threadCount : 1;
+}
+
+/* Calls work(index, worker) for every index below count, using up to jobs
+ * threads including the calling one. worker is below workerCount(count,
+ * jobs) and no two threads have the same one, so it can pick out state
+ * that belongs to one thread, such as an arena.
+ */
+template<class Work>
+void forEachIndex(size_t count, int jobs, const Work &work) {
+    std::atomic<size_t> next(0);
+    auto worker = [count, &next, &work](unsigned workerIndex) {
+        while (true) {
+            size_t index = next++;
+            if (index >= count) {
+                return;
+            }
+            work(index, workerIndex);
+        }
+    };
+
+    unsigned threadCount = workerCount(count, jobs);
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < threadCount; ++i) {
+        threads.push_back(std::thread(worker, i));
+    }
+    worker(0);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+#endif
@@ -1,9 +1,18 @@
-#include <iostream>
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
 #include "gbuilder.h"
 
+// reserved words and other names the parser checks for
+static const Name kwAsm("asm");
+static const Name kwConstant("constant");
+static const Name kwFunction("function");
+static const Name kwLabel("label");
+static const Name kwLocal("local");
+static const Name kwReturn("return");
+static const Name nameStack("sp");
+
 static int floatAsInt(float initial) {
     union {
         int a;
@@ -13,32 +22,65 @@ static int floatAsInt(float initial) {
     return typepun.a;
 }
 
+/* Parses the whole file. Each construct reports the first problem it finds
+ * and gives up, returning false or null; the parser then skips ahead to
+ * the next place it can start again, so every problem in the file is
+ * reported in one go without one mistake causing a string of others.
+ */
 void Parser::doParse() {
-    while (here()) {
-        try {
-            if (matches(EndOfFile)) {
-                // do nothing
-                next();
-            } else if (matches("constant")) {
-                doConstant();
-            } else if (matches("function")) {
-                std::shared_ptr<FunctionDef> newfunc(doFunction());
-                if (newfunc) {
-                    gamedata.functions.push_back(newfunc);
-                }
-            } else {
-                std::stringstream ss;
-                ss << "unexpected token ";
-                ss << tokenTypeName(here()->type);
-                ss << " at top level.";
-                errors.add(ErrorLogger::Error, here()->origin, ss.str());
-                next();
+    while (here() && !matches(EndOfFile)) {
+        bool parsed = false;
+        if (matches(kwConstant)) {
+            parsed = doConstant();
+        } else if (matches(kwFunction)) {
+            FunctionDef *newfunc = doFunction();
+            if (newfunc) {
+                gamedata.functions.push_back(newfunc);
+                parsed = true;
             }
-        } catch (ParserError &e) {
-            std::cerr << "Fatal error occured.\n";
-            return;
+        } else {
+            std::stringstream ss;
+            ss << "unexpected token ";
+            ss << tokenTypeName(here()->type);
+            ss << " at top level.";
+            error(here()->origin, ss.str());
+        }
+        if (!parsed) {
+            synchronizeTopLevel();
         }
     }
+    resolveFixups();
+}
+
+/* Binds a name used in the current scope to what it refers to. Only a name
+ * declared in this very scope is bound straight away. Anything else is
+ * looked up again at the end of the file, once every local and label in
+ * the function is known, so a use always gets the declaration closest to
+ * it however the two are ordered. The name is in the value's text.
+ */
+void Parser::bindName(Value *value, const Origin &origin) {
+    SymbolDef *symbol = curTable->find(value->text);
+    if (symbol) {
+        symbol->bind(*value, curFunction);
+    } else {
+        fixups.push_back(Fixup(value, curTable, curFunction, origin));
+    }
+}
+
+/* Looks up the names that bindName left for the end of the file. Those
+ * that are still unknown are left for after the files are merged, since they
+ * may be globals declared in another file.
+ */
+void Parser::resolveFixups() {
+    for (const Fixup &fixup : fixups) {
+        SymbolDef *symbol = fixup.scope->get(fixup.value->text);
+        if (symbol) {
+            symbol->bind(*fixup.value, fixup.function);
+        } else {
+            gamedata.unresolved.push_back(NameUse(fixup.value, fixup.origin));
+        }
+    }
+    fixups.clear();
 }
 
 
@@ -46,51 +88,64 @@ void Parser::doParse() {
  * TOP LEVEL CONSTRUCTS                                         *
  * ************************************************************ */
 
-void Parser::doConstant() {
-    expect("constant");
-
-    expect(Identifier);
-    const std::string &name = here()->vText;
+bool Parser::doConstant() {
+    if (!expect(kwConstant) || !expect(Identifier)) {
+        return false;
+    }
+    Name name = here()->vText;
+    const Origin &origin = here()->origin;
     next();
 
-    symbolExists(gamedata.symbols, name);
+    symbolExists(gamedata.symbols, name, origin);
 
-    expectAdv(Assignment);
+    if (!expectAdv(Assignment)) {
+        return false;
+    }
 
     if (matches(Integer)) {
-        SymbolDef *symbol = new SymbolDef(name, SymbolDef::Constant);
+        SymbolDef *symbol = gamedata.arena.make<SymbolDef>(name, SymbolDef::Constant, origin);
         symbol->value = here()->vInteger;
         gamedata.symbols.add(symbol);
         next();
     } else if (matches(Float)) {
-        SymbolDef *symbol = new SymbolDef(name, SymbolDef::Constant);
+        SymbolDef *symbol = gamedata.arena.make<SymbolDef>(name, SymbolDef::Constant, origin);
         symbol->value = floatAsInt(here()->vFloat);
         gamedata.symbols.add(symbol);
         next();
     } else {
         expect(Integer);
+        return false;
     }
 
-    expectAdv(Semicolon);
+    return expectAdv(Semicolon);
 }
 
-std::shared_ptr<FunctionDef> Parser::doFunction() {
+FunctionDef* Parser::doFunction() {
     const Origin &origin = here()->origin;
-    expect("function");
-    expect(Identifier);
+    if (!expect(kwFunction) || !expect(Identifier)) {
+        return nullptr;
+    }
 
-    std::shared_ptr<FunctionDef> newfunc(new FunctionDef);
+    symbolExists(gamedata.symbols, here()->vText, here()->origin);
+    FunctionDef *newfunc = gamedata.arena.make<FunctionDef>();
     newfunc->name = here()->vText;
     newfunc->args.parent = &gamedata.symbols;
     newfunc->origin = origin;
+    curFunction = newfunc;
+    nextLocal = 0;
+    usedLocals = 0;
+    maxLocals = 0;
     next();
-    expectAdv(OpenParan);
+    if (!expectAdv(OpenParan)) {
+        return nullptr;
+    }
     if (matches(Identifier)) {
         while (true) {
-            expect(Identifier);
-            symbolExists(newfunc->args, here()->vText);
-            SymbolDef *sym = new SymbolDef(here()->vText, SymbolDef::Local);
-            newfunc->args.add(sym);
+            if (!expect(Identifier)) {
+                return nullptr;
+            }
+            symbolExists(newfunc->args, here()->vText, here()->origin);
+            declareLocal(here()->vText, here()->origin, newfunc->args);
             next();
             if (matches(Comma)) {
                 next();
@@ -99,17 +154,21 @@ std::shared_ptr<FunctionDef> Parser::doFunction() {
             }
         }
     }
-    expectAdv(CloseParan);
+    if (!expectAdv(CloseParan)) {
+        return nullptr;
+    }
     curTable = &newfunc->args;
     newfunc->code = doCodeBlock();
+    newfunc->localCount = maxLocals;
     if (!newfunc->code) {
         return nullptr;
     }
-    gamedata.symbols.add(new SymbolDef(newfunc->name, SymbolDef::Function));
+    gamedata.symbols.add(gamedata.arena.make<SymbolDef>(newfunc->name, SymbolDef::Function,
+                                                      newfunc->origin));
 
-    std::shared_ptr<LiteralExpression> retValue(new LiteralExpression);
+    LiteralExpression *retValue = gamedata.arena.make<LiteralExpression>();
     retValue->litValue = 0;
-    std::shared_ptr<ReturnDef> defaultReturn(new ReturnDef);
+    ReturnDef *defaultReturn = gamedata.arena.make<ReturnDef>();
     defaultReturn->retValue = retValue;
     newfunc->code->statements.push_back(defaultReturn);
     return newfunc;
@@ -120,60 +179,104 @@ std::shared_ptr<FunctionDef> Parser::doFunction() {
  * STATEMENT PARSING                                            *
  * ************************************************************ */
 
- std::shared_ptr<StatementDef> Parser::doStatement() {
-    std::shared_ptr<StatementDef> stmt;
-    try {
-        if (here()->type == OpenBrace) {
-            stmt = doCodeBlock();
-        } else if (matches("local")) {
-            if (!doLocalsStmt()) return nullptr;
-        } else if (matches("return")) {
-            stmt = doReturn();
-        } else if (matches("label")) {
-            stmt = doLabel();
-        } else if (matches("asm")) {
-            stmt = doAsmBlock();
-        } else if (matches(Semicolon)) {
-            next();
-        } else {
-            stmt = doExpressionStmt();
-        }
-    } catch (ParserError &e) {
+/* Parses one statement, or skips past it if it has a mistake. Null comes
+ * back both then and for statements that leave nothing in the tree, such
+ * as declarations of locals.
+ */
+StatementDef* Parser::doStatement() {
+    StatementDef *stmt = nullptr;
+    bool parsed = true;
+    if (matches(OpenBrace)) {
+        stmt = doCodeBlock();
+        parsed = stmt != nullptr;
+    } else if (matches(kwLocal)) {
+        parsed = doLocalsStmt();
+    } else if (matches(kwReturn)) {
+        stmt = doReturn();
+        parsed = stmt != nullptr;
+    } else if (matches(kwLabel)) {
+        stmt = doLabel();
+        parsed = stmt != nullptr;
+    } else if (matches(kwAsm)) {
+        stmt = doAsmBlock();
+        parsed = stmt != nullptr;
+    } else if (matches(Semicolon)) {
+        next();
+    } else {
+        stmt = doExpressionStmt();
+        parsed = stmt != nullptr;
+    }
+    if (!parsed) {
         synchronize();
+        return nullptr;
     }
     return stmt;
 }
 
-std::shared_ptr<CodeBlock> Parser::doCodeBlock() {
+/* A block's locals take the slots after those of the blocks it is in, so
+ * blocks side by side share their slots. Slots used inside a block that has
+ * ended are kept from locals declared later in the blocks around it, since
+ * those locals can be used in the ended block.
+ */
+CodeBlock* Parser::doCodeBlock() {
     const Origin &origin = here()->origin;
-    expectAdv(OpenBrace);
+    if (!expectAdv(OpenBrace)) {
+        return nullptr;
+    }
 
-    std::shared_ptr<CodeBlock> code(new CodeBlock);
+    CodeBlock *code = gamedata.arena.make<CodeBlock>();
     code->origin = origin;
     code->locals.parent = curTable;
+    int outerNext = nextLocal;
+    int outerUsed = usedLocals;
+    usedLocals = nextLocal;
+    bool closed = true;
     while (!matches(CloseBrace)) {
-        if (here() == nullptr) {
-            return nullptr;
+        if (!here() || matches(EndOfFile)) {
+            expect(CloseBrace);
+            closed = false;
+            break;
         }
 
         curTable = &code->locals;
-        std::shared_ptr<StatementDef> stmt(doStatement());
+        StatementDef *stmt = doStatement();
         if (stmt) {
             code->statements.push_back(stmt);
         }
     }
+    nextLocal = outerNext;
+    usedLocals = std::max(outerUsed, usedLocals);
+    if (!closed) {
+        return nullptr;
+    }
     next();
     return code;
 }
 
+/* Declares an argument or local and gives it the next frame slot free in
+ * the current block.
+ */
+SymbolDef* Parser::declareLocal(const Name &name, const Origin &origin, SymbolTable &table) {
+    SymbolDef *sym = gamedata.arena.make<SymbolDef>(name, SymbolDef::Local, origin);
+    nextLocal = std::max(nextLocal, usedLocals);
+    sym->value = nextLocal++;
+    usedLocals = nextLocal;
+    maxLocals = std::max(maxLocals, nextLocal);
+    table.add(sym);
+    return sym;
+}
+
 bool Parser::doLocalsStmt() {
-    expect("local");
+    if (!expect(kwLocal)) {
+        return false;
+    }
 
     while (true) {
-        expect(Identifier);
-        symbolExists(*curTable, here()->vText);
-        SymbolDef *sym = new SymbolDef(here()->vText, SymbolDef::Local);
-        curTable->add(sym);
+        if (!expect(Identifier)) {
+            return false;
+        }
+        symbolExists(*curTable, here()->vText, here()->origin);
+        declareLocal(here()->vText, here()->origin, *curTable);
         next();
         if (matches(Comma)) {
             next();
@@ -181,46 +284,62 @@ bool Parser::doLocalsStmt() {
             break;
         }
     }
-    expectAdv(Semicolon);
-    return true;
+    return expectAdv(Semicolon);
 }
 
-std::shared_ptr<LabelStmt> Parser::doLabel() {
-    expect("label");
-    expect(Identifier);
-    const std::string &name = here()->vText;
+LabelStmt* Parser::doLabel() {
+    if (!expect(kwLabel) || !expect(Identifier)) {
+        return nullptr;
+    }
+    Name name = here()->vText;
+    const Origin &origin = here()->origin;
     next();
-    expectAdv(Semicolon);
-    symbolExists(*curTable, name);
-    SymbolDef *sym = new SymbolDef(name, SymbolDef::Label);
+    if (!expectAdv(Semicolon)) {
+        return nullptr;
+    }
+    symbolExists(*curTable, name, origin);
+    SymbolDef *sym = gamedata.arena.make<SymbolDef>(name, SymbolDef::Label, origin);
+    // labels are numbered within their function, and outside it go by a
+    // name that includes the function's
+    sym->value = curFunction->labels.size();
+    curFunction->labels.push_back(Name("__" + curFunction->name.str() + "__" + name.str()));
     curTable->add(sym, true);
-    return std::shared_ptr<LabelStmt>(new LabelStmt(name));
+    return gamedata.arena.make<LabelStmt>(curFunction->labels.back());
 }
 
-std::shared_ptr<ReturnDef> Parser::doReturn() {
-    expect("return");
-    std::shared_ptr<ReturnDef> returnStmt(new ReturnDef);
+ReturnDef* Parser::doReturn() {
+    if (!expect(kwReturn)) {
+        return nullptr;
+    }
+    ReturnDef *returnStmt = gamedata.arena.make<ReturnDef>();
     if (!matches(Semicolon)) {
         returnStmt->retValue = doExpression();
+        if (!returnStmt->retValue) {
+            return nullptr;
+        }
     } else {
-        std::shared_ptr<LiteralExpression> retValue(new LiteralExpression);
+        LiteralExpression *retValue = gamedata.arena.make<LiteralExpression>();
         retValue->litValue = 0;
         returnStmt->retValue = retValue;
     }
-    expectAdv(Semicolon);
+    if (!expectAdv(Semicolon)) {
+        return nullptr;
+    }
     return returnStmt;
 }
 
-std::shared_ptr<ExpressionDef> Parser::doExpression() {
-    std::shared_ptr<ExpressionDef> expr;
+ExpressionDef* Parser::doExpression() {
+    ExpressionDef *expr = nullptr;
     if (matches(Integer)) {
-        std::shared_ptr<LiteralExpression> realExpr(new LiteralExpression);
+        LiteralExpression *realExpr = gamedata.arena.make<LiteralExpression>();
         realExpr->litValue = here()->vInteger;
         expr = realExpr;
         next();
     } else if (matches(Identifier)) {
-        std::shared_ptr<NameExpression> realExpr(new NameExpression);
+        NameExpression *realExpr = gamedata.arena.make<NameExpression>();
         realExpr->name = here()->vText;
+        realExpr->value.text = here()->vText;
+        bindName(&realExpr->value, here()->origin);
         expr = realExpr;
         next();
     } else {
@@ -228,21 +347,24 @@ std::shared_ptr<ExpressionDef> Parser::doExpression() {
         ss << "unexpected token ";
         ss << tokenTypeName(here()->type);
         ss << " in expression.";
-        errors.add(ErrorLogger::Error, here()->origin, ss.str());
-        synchronize();
+        error(here()->origin, ss.str());
         return nullptr;
     }
     return expr;
 }
 
-std::shared_ptr<ExpressionStmt> Parser::doExpressionStmt() {
-    std::shared_ptr<ExpressionStmt> stmt(new ExpressionStmt);
-    stmt->expr = doExpression();
+ExpressionStmt* Parser::doExpressionStmt() {
+    ExpressionDef *expr = doExpression();
+    if (!expr) {
+        return nullptr;
+    }
+    ExpressionStmt *stmt = gamedata.arena.make<ExpressionStmt>();
+    stmt->expr = expr;
     return stmt;
 }
 
-std::shared_ptr<Value> Parser::doValue() {
-    std::shared_ptr<Value> value(new Value);
+Value* Parser::doValue() {
+    Value *value = gamedata.arena.make<Value>();
     switch(here()->type) {
         case Integer: {
             value->type = Value::Constant;
@@ -257,20 +379,21 @@ std::shared_ptr<Value> Parser::doValue() {
             return value;
         }
         case String: {
-            value->type = Value::Identifier;
-            value->text = gamedata.addString(here()->vText);
+            value->type = Value::String;
+            value->text = here()->vText;
+            gamedata.strings.add(value->text);
             next();
             return value;
         }
         case Identifier: {
             value->type = Value::Identifier;
             value->text = here()->vText;
+            bindName(value, here()->origin);
             next();
             return value;
         }
         default:
-            errors.add(ErrorLogger::Error, Origin("(unknown)",0,0), "expected value");
-            next();
+            error(here()->origin, "expected value");
             return nullptr;
     }
 }
@@ -280,71 +403,80 @@ std::shared_ptr<Value> Parser::doValue() {
  * ASSEMBLY PARSING                                             *
  * ************************************************************ */
 
- std::shared_ptr<StatementDef> Parser::doAsmBlock() {
+StatementDef* Parser::doAsmBlock() {
     const Origin &origin = here()->origin;
-    expect("asm");
+    if (!expect(kwAsm)) {
+        return nullptr;
+    }
 
     if (!matches(OpenBrace)) {
         return doAsmStatement();
     }
 
-    expectAdv(OpenBrace);
-    std::shared_ptr<CodeBlock> code(new CodeBlock);
+    next();
+    CodeBlock *code = gamedata.arena.make<CodeBlock>();
     code->origin = origin;
     code->locals.parent = curTable;
 
 
     while (!matches(CloseBrace)) {
-        if (here() == nullptr) {
+        if (!here() || matches(EndOfFile)) {
+            expect(CloseBrace);
             return nullptr;
         }
 
-        std::shared_ptr<StatementDef> stmt = doAsmStatement();
+        StatementDef *stmt = doAsmStatement();
         if (stmt) {
             code->statements.push_back(stmt);
+        } else {
+            synchronize();
         }
     }
     next();
     return code;
 }
 
-std::shared_ptr<StatementDef> Parser::doAsmStatement() {
-    if (matches("label")) return doLabel();
+StatementDef* Parser::doAsmStatement() {
+    if (matches(kwLabel)) return doLabel();
 
     if (!matches(Identifier) && !matches(ReservedWord)) {
         expect(Identifier);
+        return nullptr;
     }
-    std::shared_ptr<AsmStatement> stmt(new AsmStatement);
-    stmt->opname = here()->vText;
-    next();
-
-    const AsmCode &ac = opcodeByName(stmt->opname);
+    const AsmCode &ac = opcodeByName(here()->vText.str());
     if (ac.name == nullptr) {
-        errors.add(ErrorLogger::Error, Origin("(unknown)",0,0), "unknown assembly mnemonic");
-    } else {
-        stmt->opcode = ac.opcode;
-        stmt->isRelative = ac.relative;
+        // an instruction without a code would break every later pass
+        error(here()->origin, "unknown assembly mnemonic");
+        return nullptr;
     }
+    AsmStatement *stmt = gamedata.arena.make<AsmStatement>();
+    stmt->origin = here()->origin;
+    stmt->code = &ac;
+    next();
 
     while (!matches(Semicolon)) {
-        std::shared_ptr<AsmOperand> op = doAsmOperand();
-        if (op) {
-            stmt->operands.push_back(op);
+        if (!here() || matches(EndOfFile)) {
+            expect(Semicolon);
+            return nullptr;
         }
+        AsmOperand *op = doAsmOperand();
+        if (!op) {
+            return nullptr;
+        }
+        stmt->operands.push_back(op);
     }
+    next();
 
     if (ac.operands != stmt->operands.size()) {
-        errors.add(ErrorLogger::Error, Origin("(unknown)",0,0), "bad operand count");
+        error(stmt->origin, "bad operand count");
     }
-
-    expectAdv(Semicolon);
     return stmt;
 }
 
-std::shared_ptr<AsmOperand> Parser::doAsmOperand() {
-    std::shared_ptr<AsmOperand> op(new AsmOperand);
+AsmOperand* Parser::doAsmOperand() {
+    AsmOperand *op = gamedata.arena.make<AsmOperand>();
 
-    if (matches(Identifier) && here()->vText == "sp") {
+    if (matches(Identifier) && here()->vText == nameStack) {
         op->isStack = true;
         next();
         return op;
@@ -359,21 +491,60 @@ std::shared_ptr<AsmOperand> Parser::doAsmOperand() {
 }
 
 
+/* Skips the rest of a statement with a mistake in it: up to and including
+ * the next semicolon, or up to the brace that closes the block it is in.
+ * Blocks opened along the way are skipped whole.
+ */
 void Parser::synchronize() {
-    while(here()->type != Semicolon && here()->type != CloseBrace && here()->type != EndOfFile) {
+    int depth = 0;
+    while (here() && !matches(EndOfFile)) {
+        if (matches(OpenBrace)) {
+            ++depth;
+        } else if (matches(CloseBrace)) {
+            if (depth == 0) {
+                return;
+            }
+            --depth;
+        } else if (matches(Semicolon) && depth == 0) {
+            next();
+            return;
+        }
         next();
     }
-    next();
 }
 
-void Parser::expect(TokenType type) {
-    if (matches(type)) {
+/* Skips to the next constant or function after a mistake outside of any
+ * function, or in a function's header. Neither can appear inside a
+ * function, so this is always a safe place to start again.
+ */
+void Parser::synchronizeTopLevel() {
+    while (here() && !matches(EndOfFile) && !matches(kwConstant) && !matches(kwFunction)) {
+        next();
+    }
+}
+
+/* Reports a mistake in the file. Once the file has had as many errors as
+ * allowed the parser gives up on the rest of it by jumping to the end of
+ * the file, and whatever it was in the middle of is left unreported.
+ */
+void Parser::error(const Origin &origin, const std::string &message) {
+    if (errorLimit > 0 && errors.errorCount() >= static_cast<unsigned>(errorLimit)) {
         return;
     }
+    errors.add(ErrorLogger::Error, origin, message);
+    if (errorLimit > 0 && errors.errorCount() >= static_cast<unsigned>(errorLimit)) {
+        errors.add(ErrorLogger::Notice, origin, "too many errors; skipping the rest of the file.");
+        current = tokens.size() - 1;
+    }
+}
 
+// true if the current token is the one given; otherwise reports it
+bool Parser::expect(TokenType type) {
+    if (matches(type)) {
+        return true;
+    }
     if (!here()) {
-        errors.add(ErrorLogger::Error, Origin("(unknown)",0,0), "Unexpected EOF");
-        throw ParserError();
+        return false;
     }
 
     std::stringstream ss;
@@ -382,14 +553,16 @@ void Parser::expect(TokenType type) {
        << " but found "
        << tokenTypeName(here()->type)
        << ".";
-    errors.add(ErrorLogger::Error, here()->origin, ss.str());
-    throw ParserError();
+    error(here()->origin, ss.str());
+    return false;
 }
 
-void Parser::expectAdv(TokenType type) {
-    expect(type);
+bool Parser::expectAdv(TokenType type) {
+    if (!expect(type)) {
+        return false;
+    }
     next();
-    return;
+    return true;
 }
 
 bool Parser::matches(TokenType type) {
@@ -399,27 +572,25 @@ bool Parser::matches(TokenType type) {
     return true;
 }
 
-void Parser::expect(const std::string &text) {
+// true and moves past the keyword if it comes next; otherwise reports it
+bool Parser::expect(const Name &text) {
     if (matches(text)) {
         next();
-        return;
+        return true;
     }
-
     if (!here()) {
-        errors.add(ErrorLogger::Error, Origin("(unknown)",0,0), "Unexpected EOF");
-        throw ParserError();
+        return false;
     }
 
     std::stringstream ss;
     ss << "expected keyword \""
-       << text
+       << text.str()
        << "\".";
-    errors.add(ErrorLogger::Error, here()->origin, ss.str());
-
-    throw ParserError();
+    error(here()->origin, ss.str());
+    return false;
 }
 
-bool Parser::matches(const std::string &text) {
+bool Parser::matches(const Name &text) {
     if (!here()) {
         return false;
     }
@@ -430,13 +601,13 @@ bool Parser::matches(const std::string &text) {
     return true;
 }
 
-bool Parser::symbolExists(const SymbolTable &table, const std::string &name) {
+bool Parser::symbolExists(const SymbolTable &table, const Name &name, const Origin &origin) {
     if (table.exists(name)) {
         std::stringstream ss;
         ss << "symbol "
-           << name
+           << name.str()
            << " already declared.";
-        errors.add(ErrorLogger::Error, Origin("(unknown)",0,0), ss.str());
+        error(origin, ss.str());
         return true;
     }
     return false;
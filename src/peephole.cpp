@@ -0,0 +1,272 @@
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <utf8.h>
+
+#include "gbuilder.h"
+
+/* Rewrites short runs of assembly into shorter equivalents. At -O1 only
+ * rules that look at neighbouring instructions are used; -O2 adds the rules
+ * that need to see where jumps go or that add new strings to the game.
+ */
+
+enum PeepholeRule {
+    RulePushPop,
+    RuleDiscard,
+    RuleRedundantCopy,
+    RuleJumpToNext,
+    RuleJumpToReturn,
+    RuleStreamChars,
+    RuleCount
+};
+
+static const char *ruleNames[RuleCount] = {
+    "push then pop",
+    "discarded value",
+    "redundant copy",
+    "jump to next line",
+    "jump to return",
+    "streamchar run",
+};
+
+static const int opCopy = 0x40;
+static const int opJump = 0x20;
+static const int opReturn = 0x31;
+static const int opStreamChar = 0x70;
+
+// shortest streamchar run worth turning into a string
+static const unsigned minStreamRun = 4;
+
+static AsmStatement* asStatement(AsmLine *line, int opcode) {
+    AsmStatement *stmt = nodeAs<AsmStatement>(line);
+    if (stmt && stmt->code->opcode == opcode) {
+        return stmt;
+    }
+    return nullptr;
+}
+
+// a value that can be read any number of times, or not at all, to no effect
+static bool isPlainLoad(const AsmOperand *op) {
+    return !op->isStack && !op->isIndirect
+        && (op->value->type == Value::Constant || op->value->type == Value::Local);
+}
+
+static bool isDiscard(const AsmOperand *op) {
+    return !op->isStack && !op->isIndirect
+        && op->value->type == Value::Constant && op->value->value == 0;
+}
+
+static bool isLabelOperand(const AsmOperand *op, const Name &label) {
+    return !op->isStack && op->value->type == Value::Identifier && op->value->text == label;
+}
+
+class Peephole {
+public:
+    Peephole(GameData &gamedata, std::vector<AsmLine*> &lines)
+    : gamedata(gamedata), lines(lines) {
+        for (int i = 0; i < RuleCount; ++i) {
+            counts[i] = 0;
+        }
+    }
+
+    AsmStatement* makeStatement(const AsmCode &code) {
+        AsmStatement *stmt = gamedata.arena.make<AsmStatement>();
+        stmt->code = &code;
+        return stmt;
+    }
+
+    /* Goes through the lines once, trying the local rules each time a line
+     * is added to the output. A rewrite can leave a new match at the end of
+     * the output, which is picked up straight away.
+     */
+    void localRules() {
+        std::vector<AsmLine*> out;
+        out.reserve(lines.size());
+        for (AsmLine *line : lines) {
+            out.push_back(line);
+            while (rewriteTail(out)) {
+            }
+        }
+        lines.swap(out);
+    }
+
+    bool rewriteTail(std::vector<AsmLine*> &out) {
+        AsmLine *last = out.back();
+
+        // jump L; [labels]; label L
+        LabelStmt *label = nodeAs<LabelStmt>(last);
+        if (label) {
+            for (size_t i = out.size() - 1; i-- > 0; ) {
+                AsmStatement *jump = asStatement(out[i], opJump);
+                if (jump && isLabelOperand(jump->operands[0], label->name)) {
+                    out.erase(out.begin() + i);
+                    ++counts[RuleJumpToNext];
+                    return true;
+                }
+                if (!nodeAs<LabelStmt>(out[i])) {
+                    break;
+                }
+            }
+            return false;
+        }
+
+        // copy X X, and copy X 0 where reading X does nothing
+        AsmStatement *copy = asStatement(last, opCopy);
+        if (copy && copy->operands.size() == 2 && isPlainLoad(copy->operands[0])) {
+            AsmOperand *from = copy->operands[0];
+            AsmOperand *to = copy->operands[1];
+            if (isDiscard(to)) {
+                out.pop_back();
+                ++counts[RuleDiscard];
+                return true;
+            }
+            if (from->value->type == Value::Local && !to->isStack && !to->isIndirect
+                    && to->value->type == Value::Local && to->value->value == from->value->value) {
+                out.pop_back();
+                ++counts[RuleRedundantCopy];
+                return true;
+            }
+        }
+
+        // copy X sp followed by something that pops it straight back off
+        if (out.size() < 2) {
+            return false;
+        }
+        AsmStatement *push = asStatement(out[out.size() - 2], opCopy);
+        if (!push || push->operands.size() != 2 || !isPlainLoad(push->operands[0])
+                || !push->operands[1]->isStack) {
+            return false;
+        }
+        AsmStatement *pop = nodeAs<AsmStatement>(last);
+        if (!pop || pop->operands.empty() || !pop->operands[0]->isStack) {
+            return false;
+        }
+        if (pop->code->opcode == opReturn || pop->code->opcode == opCopy) {
+            AsmStatement *merged = makeStatement(*pop->code);
+            merged->operands = pop->operands;
+            merged->operands[0] = push->operands[0];
+            out.pop_back();
+            out.back() = merged;
+            ++counts[RulePushPop];
+            return true;
+        }
+        return false;
+    }
+
+    /* A jump to a label that is followed by "return X" is replaced by the
+     * return itself, as long as X can be read from anywhere.
+     */
+    void jumpToReturn() {
+        std::unordered_map<Name, AsmStatement*> returns;
+        std::vector<LabelStmt*> pending;
+        for (AsmLine *line : lines) {
+            LabelStmt *label = nodeAs<LabelStmt>(line);
+            if (label) {
+                pending.push_back(label);
+                continue;
+            }
+            AsmStatement *ret = asStatement(line, opReturn);
+            if (ret && isPlainLoad(ret->operands[0])) {
+                for (LabelStmt *target : pending) {
+                    returns[target->name] = ret;
+                }
+            }
+            pending.clear();
+        }
+
+        for (AsmLine *&line : lines) {
+            AsmStatement *jump = asStatement(line, opJump);
+            if (!jump || jump->operands[0]->isStack
+                    || jump->operands[0]->value->type != Value::Identifier) {
+                continue;
+            }
+            auto ret = returns.find(jump->operands[0]->value->text);
+            if (ret != returns.end()) {
+                AsmStatement *copy = makeStatement(opcodeByName("return"));
+                copy->operands = ret->second->operands;
+                line = copy;
+                ++counts[RuleJumpToReturn];
+            }
+        }
+    }
+
+    /* Runs of streamchar with constant Latin-1 characters are printed as one
+     * string instead. The string goes into the pool like any literal, so it
+     * is shared with a literal of the same text.
+     */
+    void streamChars() {
+        std::vector<AsmLine*> out;
+        out.reserve(lines.size());
+        for (size_t i = 0; i < lines.size(); ) {
+            size_t end = i;
+            while (end < lines.size() && streamsLatin1Char(lines[end])) {
+                ++end;
+            }
+            if (end - i < minStreamRun) {
+                out.push_back(lines[i]);
+                ++i;
+                continue;
+            }
+
+            std::string text;
+            for (size_t j = i; j < end; ++j) {
+                int c = static_cast<AsmStatement*>(lines[j])->operands[0]->value->value;
+                utf8::unchecked::append(c, std::back_inserter(text));
+            }
+            Value *value = gamedata.arena.make<Value>(Name(text));
+            value->type = Value::String;
+            gamedata.strings.add(value->text);
+
+            AsmStatement *stream = makeStatement(opcodeByName("streamstr"));
+            AsmOperand *op = gamedata.arena.make<AsmOperand>();
+            op->value = value;
+            stream->operands.push_back(op);
+            out.push_back(stream);
+            ++counts[RuleStreamChars];
+            i = end;
+        }
+        lines.swap(out);
+    }
+
+    bool streamsLatin1Char(AsmLine *line) {
+        AsmStatement *stmt = asStatement(line, opStreamChar);
+        if (!stmt || stmt->operands.size() != 1) {
+            return false;
+        }
+        const AsmOperand *op = stmt->operands[0];
+        return isPlainLoad(op) && op->value->type == Value::Constant
+            && op->value->value > 0 && op->value->value <= 0xFF;
+    }
+
+    void report(std::ostream &out) const {
+        out << "PEEPHOLE REWRITES\n";
+        for (int i = 0; i < RuleCount; ++i) {
+            out << "    " << ruleNames[i] << ": " << counts[i] << '\n';
+        }
+    }
+
+private:
+    GameData &gamedata;
+    std::vector<AsmLine*> &lines;
+    int counts[RuleCount];
+};
+
+void peephole(GameData &gamedata, std::vector<AsmLine*> &lines, int level, bool showReport,
+              std::ostream &out) {
+    if (level <= 0) {
+        return;
+    }
+
+    Peephole optimizer(gamedata, lines);
+    optimizer.localRules();
+    if (level >= 2) {
+        optimizer.jumpToReturn();
+        optimizer.streamChars();
+    }
+    if (showReport) {
+        optimizer.report(out);
+    }
+}
@@ -58,6 +58,10 @@ ProjectFile* load_project(const char *project_file) {
             for (const std::string &file : tokens) {
                 pf->sourceFiles.push_back(file);
             }
+        } else if (what == "export") {
+            for (const std::string &name : tokens) {
+                pf->exports.push_back(name);
+            }
         } else if (what == "output") {
             if (tokens.size() != 1) {
                 std::cerr << "Output must specify exactly one filename.\n";
@@ -65,6 +69,20 @@ ProjectFile* load_project(const char *project_file) {
                 return nullptr;
             }
             pf->outputFile = tokens.front();
+        } else if (what == "compress") {
+            if (tokens.size() != 1 || (tokens.front() != "yes" && tokens.front() != "no")) {
+                std::cerr << "Compress must be either yes or no.\n";
+                delete pf;
+                return nullptr;
+            }
+            pf->compressStrings = tokens.front() == "yes";
+        } else if (what == "cache") {
+            if (tokens.size() != 1) {
+                std::cerr << "Cache must specify exactly one directory.\n";
+                delete pf;
+                return nullptr;
+            }
+            pf->cacheDirectory = tokens.front();
         } else {
             std::cout << "Items: " << tokens.size() << "\n";
             for (const std::string &s : tokens) {
@@ -8,13 +8,19 @@
 class ProjectFile {
 public:
     ProjectFile()
-    : stackSize(2048), extraMemory(0), outputFile("output.ulx")
+    : stackSize(2048), extraMemory(0), compressStrings(false), outputFile("output.ulx")
     { }
 
     int stackSize;
     int extraMemory;
+    // store string literals Huffman compressed where that is smaller
+    bool compressStrings;
     std::vector<std::string> sourceFiles;
+    // functions kept in the game even if nothing in it refers to them
+    std::vector<std::string> exports;
     std::string outputFile;
+    // where front end results are cached between builds; empty for none
+    std::string cacheDirectory;
 };
 
 ProjectFile* load_project(const char *project_file);
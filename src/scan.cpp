@@ -0,0 +1,227 @@
+#include <cstddef>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* ************************************************************ *
+ * SCALAR VERSIONS                                              *
+ * ************************************************************ */
+
+static inline bool isSpace(unsigned char c) {
+    // space, or one of \t \n \v \f \r
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+static size_t scanSpacesScalar(const char *text, size_t pos, size_t size) {
+    while (pos < size && isSpace(text[pos])) {
+        ++pos;
+    }
+    return pos;
+}
+
+static size_t scanForScalar(const char *text, size_t pos, size_t size, char a, char b) {
+    while (pos < size && text[pos] != a && text[pos] != b) {
+        ++pos;
+    }
+    return pos;
+}
+
+static size_t scanNonAsciiScalar(const char *text, size_t pos, size_t size) {
+    while (pos < size && static_cast<unsigned char>(text[pos]) < 0x80) {
+        ++pos;
+    }
+    return pos;
+}
+
+
+/* ************************************************************ *
+ * SSE2 AND AVX2 VERSIONS                                       *
+ * ************************************************************ */
+
+#ifdef SCAN_X86
+
+static size_t scanSpacesSse2(const char *text, size_t pos, size_t size) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i belowTab = _mm_set1_epi8('\t' - 1);
+    const __m128i aboveReturn = _mm_set1_epi8('\r' + 1);
+    while (pos + 16 <= size) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+        __m128i control = _mm_and_si128(_mm_cmpgt_epi8(chunk, belowTab),
+                                        _mm_cmplt_epi8(chunk, aboveReturn));
+        __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(chunk, space), control);
+        unsigned others = ~_mm_movemask_epi8(spaces) & 0xFFFF;
+        if (others) {
+            return pos + __builtin_ctz(others);
+        }
+        pos += 16;
+    }
+    return scanSpacesScalar(text, pos, size);
+}
+
+static size_t scanForSse2(const char *text, size_t pos, size_t size, char a, char b) {
+    const __m128i first = _mm_set1_epi8(a);
+    const __m128i second = _mm_set1_epi8(b);
+    while (pos + 16 <= size) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(chunk, first), _mm_cmpeq_epi8(chunk, second));
+        unsigned mask = _mm_movemask_epi8(found);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+    return scanForScalar(text, pos, size, a, b);
+}
+
+static size_t scanNonAsciiSse2(const char *text, size_t pos, size_t size) {
+    while (pos + 16 <= size) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+        unsigned mask = _mm_movemask_epi8(chunk);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+    return scanNonAsciiScalar(text, pos, size);
+}
+
+__attribute__((target("avx2")))
+static size_t scanSpacesAvx2(const char *text, size_t pos, size_t size) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i belowTab = _mm256_set1_epi8('\t' - 1);
+    const __m256i aboveReturn = _mm256_set1_epi8('\r' + 1);
+    while (pos + 32 <= size) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + pos));
+        __m256i control = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, belowTab),
+                                           _mm256_cmpgt_epi8(aboveReturn, chunk));
+        __m256i spaces = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), control);
+        unsigned others = ~static_cast<unsigned>(_mm256_movemask_epi8(spaces));
+        if (others) {
+            return pos + __builtin_ctz(others);
+        }
+        pos += 32;
+    }
+    return scanSpacesSse2(text, pos, size);
+}
+
+__attribute__((target("avx2")))
+static size_t scanForAvx2(const char *text, size_t pos, size_t size, char a, char b) {
+    const __m256i first = _mm256_set1_epi8(a);
+    const __m256i second = _mm256_set1_epi8(b);
+    while (pos + 32 <= size) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + pos));
+        __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, first), _mm256_cmpeq_epi8(chunk, second));
+        unsigned mask = _mm256_movemask_epi8(found);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+    return scanForSse2(text, pos, size, a, b);
+}
+
+__attribute__((target("avx2")))
+static size_t scanNonAsciiAvx2(const char *text, size_t pos, size_t size) {
+    while (pos + 32 <= size) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + pos));
+        unsigned mask = _mm256_movemask_epi8(chunk);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+    return scanNonAsciiSse2(text, pos, size);
+}
+
+#endif
+
+
+/* ************************************************************ *
+ * DISPATCH                                                     *
+ * ************************************************************ */
+
+class ScanKernels {
+public:
+    ScanKernels()
+    : spaces(scanSpacesScalar), find(scanForScalar), nonAscii(scanNonAsciiScalar) {
+#ifdef SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            spaces = scanSpacesAvx2;
+            find = scanForAvx2;
+            nonAscii = scanNonAsciiAvx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            spaces = scanSpacesSse2;
+            find = scanForSse2;
+            nonAscii = scanNonAsciiSse2;
+        }
+#endif
+    }
+
+    size_t (*spaces)(const char*, size_t, size_t);
+    size_t (*find)(const char*, size_t, size_t, char, char);
+    size_t (*nonAscii)(const char*, size_t, size_t);
+};
+
+static const ScanKernels& kernels() {
+    static const ScanKernels chosen;
+    return chosen;
+}
+
+size_t scanSpaces(const char *text, size_t pos, size_t size) {
+    return kernels().spaces(text, pos, size);
+}
+
+size_t scanFor(const char *text, size_t pos, size_t size, char a, char b) {
+    return kernels().find(text, pos, size, a, b);
+}
+
+size_t scanNonAscii(const char *text, size_t pos, size_t size) {
+    return kernels().nonAscii(text, pos, size);
+}
+
+
+/* ************************************************************ *
+ * UTF-8 VALIDATION                                             *
+ * ************************************************************ */
+
+bool validUtf8(const char *text, size_t size) {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(text);
+    size_t pos = 0;
+    while (true) {
+        pos = scanNonAscii(text, pos, size);
+        if (pos >= size) {
+            return true;
+        }
+
+        unsigned lead = bytes[pos];
+        unsigned length, codepoint, minimum;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2; codepoint = lead & 0x1F; minimum = 0x80;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3; codepoint = lead & 0x0F; minimum = 0x800;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4; codepoint = lead & 0x07; minimum = 0x10000;
+        } else {
+            return false;
+        }
+        if (pos + length > size) {
+            return false;
+        }
+        for (unsigned i = 1; i < length; ++i) {
+            if ((bytes[pos + i] & 0xC0) != 0x80) {
+                return false;
+            }
+            codepoint = (codepoint << 6) | (bytes[pos + i] & 0x3F);
+        }
+        if (codepoint < minimum || codepoint > 0x10FFFF
+                || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+            return false;
+        }
+        pos += length;
+    }
+}
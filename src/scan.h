@@ -0,0 +1,25 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstddef>
+
+/* Bulk scanning routines used by the lexer to get through whitespace,
+ * comments and string literals quickly. Each one looks at text[pos] up to
+ * (but not including) text[size] and returns the position it stopped at,
+ * or size if it reached the end.
+ *
+ * On x86 these use SSE2 or AVX2, chosen once at run time from what the
+ * processor supports. Elsewhere a plain scalar version is used.
+ */
+
+// first position that is not a whitespace character
+size_t scanSpaces(const char *text, size_t pos, size_t size);
+// first position holding either a or b
+size_t scanFor(const char *text, size_t pos, size_t size, char a, char b);
+// first position holding a byte above 127
+size_t scanNonAscii(const char *text, size_t pos, size_t size);
+
+// true if text is well formed UTF-8
+bool validUtf8(const char *text, size_t size);
+
+#endif
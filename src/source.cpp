@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gbuilder.h"
+
+SourceFile::SourceFile(const std::string &filename, bool mapFile)
+: filename(filename), text(nullptr), length(0), isMapped(false) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file.");
+    }
+
+    struct stat info;
+    if (mapFile && fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            text = static_cast<const char*>(mapping);
+            length = info.st_size;
+            isMapped = true;
+        }
+    }
+    close(fd);
+    if (isMapped) {
+        return;
+    }
+
+    std::ifstream inf(filename, std::ios_base::binary);
+    if (!inf) {
+        throw std::runtime_error("Could not open file.");
+    }
+    buffer.assign( (std::istreambuf_iterator<char>(inf)),
+                   std::istreambuf_iterator<char>() );
+    text = buffer.data();
+    length = buffer.size();
+}
+
+SourceFile::~SourceFile() {
+    if (isMapped) {
+        munmap(const_cast<char*>(text), length);
+    }
+}
+
+
+SourceManager::SourceManager()
+: mapFiles(true) {
+    addPseudoFile("(unknown)");
+}
+
+uint32_t SourceManager::addFile(const std::string &filename) {
+    std::unique_ptr<SourceFile> file(new SourceFile(filename, mapFiles));
+    files.push_back(Entry());
+    files.back().name = filename;
+    files.back().file = std::move(file);
+    return files.size() - 1;
+}
+
+uint32_t SourceManager::addPseudoFile(const std::string &name) {
+    files.push_back(Entry());
+    files.back().name = name;
+    return files.size() - 1;
+}
+
+/* Reads a file again after it has changed on disk. The file keeps its id,
+ * so anything still holding an Origin in the file should be thrown away.
+ */
+void SourceManager::reload(uint32_t fileId) {
+    Entry &entry = files[fileId];
+    entry.file.reset();
+    entry.lineStarts.clear();
+    entry.file.reset(new SourceFile(entry.name, mapFiles));
+}
+
+const std::string& SourceManager::name(uint32_t fileId) const {
+    return files[fileId].name;
+}
+
+SourceView SourceManager::text(uint32_t fileId) const {
+    if (files[fileId].file) {
+        return files[fileId].file->view();
+    }
+    return SourceView();
+}
+
+void SourceManager::lineAndColumn(const Origin &origin, int &line, int &column) {
+    Entry &entry = files[origin.fileId];
+    if (!entry.file) {
+        line = column = 0;
+        return;
+    }
+
+    if (entry.lineStarts.empty()) {
+        SourceView source = entry.file->view();
+        entry.lineStarts.push_back(0);
+        for (size_t i = 0; i < source.size(); ++i) {
+            if (source[i] == '\n') {
+                entry.lineStarts.push_back(i + 1);
+            }
+        }
+    }
+
+    auto after = std::upper_bound(entry.lineStarts.begin(), entry.lineStarts.end(), origin.offset);
+    line = after - entry.lineStarts.begin();
+    column = origin.offset - *(after - 1) + 1;
+}
+
+SourceManager& sourceManager() {
+    static SourceManager manager;
+    return manager;
+}
+
+
+const std::string& Origin::file() const {
+    return sourceManager().name(fileId);
+}
+
+int Origin::line() const {
+    int line, column;
+    sourceManager().lineAndColumn(*this, line, column);
+    return line;
+}
+
+int Origin::column() const {
+    int line, column;
+    sourceManager().lineAndColumn(*this, line, column);
+    return column;
+}
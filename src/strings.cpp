@@ -0,0 +1,661 @@
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <utf8.h>
+
+#include "gbuilder.h"
+
+/* Lays out the string literals the finished program still refers to. Each
+ * distinct text is stored once, in the order it is first used, as an E0
+ * string when every character fits in Latin-1 and as an E2 string
+ * otherwise.
+ *
+ * When compression is turned on, strings can instead be stored as E1
+ * strings: Huffman codes for single characters and for common runs of
+ * characters, which are looked up in a decoding table placed at the start
+ * of the game.
+ *
+ * The strings are put ahead of the code, not after it, so in the game file
+ * they come before the first function. Every string gets a label and the
+ * operands that used its handle are pointed at the label, so later passes
+ * only ever see label references.
+ */
+
+class PooledString {
+public:
+    PooledString()
+    : latin1(true), references(0), compressed(false)
+    { }
+
+    // the size of the string stored as E0 or E2
+    int plainSize() const {
+        return latin1 ? chars.size() + 2 : chars.size() * 4 + 8;
+    }
+
+    Name handle;
+    Name label;
+    std::vector<unsigned> chars;
+    bool latin1;
+    int references;
+    bool compressed;
+    // the characters and abbreviations the string is compressed as
+    std::vector<int> symbols;
+};
+
+/* ************************************************************ *
+ * COMPRESSION                                                  *
+ * ************************************************************ */
+
+// symbols past the last Unicode character stand for abbreviations
+static const int firstAbbreviation = 0x110000;
+static const int stringEnd = -1;
+static const unsigned maxAbbreviations = 64;
+static const unsigned maxAbbreviationLength = 8;
+// runs of text considered as abbreviations, best first
+static const unsigned maxCandidates = 1000;
+// strings used in this many places are printed often enough that decoding
+// them each time costs more than the bytes compressing them saves
+static const int hotReferences = 8;
+
+static const int nodeBranch = 0x00;
+static const int nodeEnd = 0x01;
+static const int nodeChar = 0x02;
+static const int nodeCString = 0x03;
+static const int nodeUnicodeChar = 0x04;
+static const int nodeUnicodeString = 0x05;
+
+class HuffmanNode {
+public:
+    HuffmanNode(int symbol, long weight)
+    : symbol(symbol), weight(weight), left(-1), right(-1), address(0)
+    { }
+
+    bool isLeaf() const {
+        return left < 0;
+    }
+
+    int symbol;
+    long weight;
+    int left, right;
+    int address;
+};
+
+/* Builds the decoding table for a set of strings and encodes them with it.
+ * Abbreviations are chosen greedily: every run of up to
+ * maxAbbreviationLength characters is scored by how many characters it
+ * would replace, less what it costs in the table, and the best are taken
+ * one at a time. Taking one leaves fewer places for the others, so the
+ * counts are kept up to date as text is replaced, and a run that has fallen
+ * behind the next best by the time it comes up is put back.
+ */
+class Compressor {
+public:
+    Compressor()
+    : root(-1), tableSize(0)
+    { }
+
+    void chooseAbbreviations(const std::vector<PooledString*> &strings) {
+        for (PooledString *string : strings) {
+            string->symbols.assign(string->chars.begin(), string->chars.end());
+        }
+
+        // runs are counted by hash, keeping where one was first seen
+        std::unordered_map<uint64_t, Run> runs;
+        for (const PooledString *string : strings) {
+            const std::vector<int> &symbols = string->symbols;
+            for (size_t i = 0; i < symbols.size(); ++i) {
+                uint64_t hash = extendHash(runHashSeed, symbols[i]);
+                for (size_t length = 2; length <= maxAbbreviationLength && i + length <= symbols.size(); ++length) {
+                    hash = extendHash(hash, symbols[i + length - 1]);
+                    Run &run = runs[hash];
+                    if (run.count++ == 0) {
+                        run.symbols = &symbols;
+                        run.start = i;
+                        run.length = length;
+                    }
+                }
+            }
+        }
+        std::vector<std::pair<int, uint64_t>> scored;
+        for (const auto &run : runs) {
+            int score = abbreviationScore(run.second.length, run.second.count);
+            if (score > 0) {
+                scored.push_back(std::make_pair(score, run.first));
+            }
+        }
+        size_t kept = std::min<size_t>(scored.size(), maxCandidates);
+        std::partial_sort(scored.begin(), scored.begin() + kept, scored.end(),
+                          [](const std::pair<int, uint64_t> &a, const std::pair<int, uint64_t> &b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+
+        candidates.clear();
+        candidateOf.clear();
+        for (size_t i = 0; i < kept; ++i) {
+            const Run &run = runs[scored[i].second];
+            candidateOf[scored[i].second] = candidates.size();
+            candidates.push_back(Candidate(window(*run.symbols, run.start, run.length), run.count));
+        }
+
+        // ties go to the candidate that scored better to begin with
+        std::priority_queue<std::pair<int, int>> pending;
+        for (unsigned i = 0; i < candidates.size(); ++i) {
+            pending.push(std::make_pair(scored[i].first, -static_cast<int>(i)));
+        }
+        while (!pending.empty() && abbreviations.size() < maxAbbreviations) {
+            int index = -pending.top().second;
+            pending.pop();
+            const Candidate &candidate = candidates[index];
+            int score = abbreviationScore(candidate.text.size(), candidate.count);
+            if (score <= 0) {
+                continue;
+            }
+            if (!pending.empty() && score < pending.top().first) {
+                pending.push(std::make_pair(score, -index));
+                continue;
+            }
+            replace(strings, candidate.text, firstAbbreviation + abbreviations.size());
+            abbreviations.push_back(candidate.text);
+        }
+    }
+
+    /* Builds the Huffman tree for the strings and lays the table out for
+     * the address it will be placed at.
+     */
+    void buildTree(const std::vector<PooledString*> &strings, int address) {
+        std::map<int, long> weights;
+        for (const PooledString *string : strings) {
+            for (int symbol : string->symbols) {
+                ++weights[symbol];
+            }
+            ++weights[stringEnd];
+        }
+
+        nodes.clear();
+        typedef std::pair<long, int> Weighted;
+        std::priority_queue<Weighted, std::vector<Weighted>, std::greater<Weighted>> pending;
+        for (const auto &weight : weights) {
+            pending.push(std::make_pair(weight.second, nodes.size()));
+            nodes.push_back(HuffmanNode(weight.first, weight.second));
+        }
+        // the root must be a branch, even if there is only one symbol
+        if (nodes.size() == 1) {
+            pending.push(std::make_pair(nodes[0].weight, 0));
+        }
+        while (pending.size() > 1) {
+            Weighted left = pending.top();
+            pending.pop();
+            Weighted right = pending.top();
+            pending.pop();
+            HuffmanNode branch(0, left.first + right.first);
+            branch.left = left.second;
+            branch.right = right.second;
+            pending.push(std::make_pair(branch.weight, nodes.size()));
+            nodes.push_back(branch);
+        }
+        root = pending.top().second;
+
+        codes.clear();
+        tableSize = 12;
+        std::vector<bool> code;
+        assign(root, code, address);
+    }
+
+    // the size of a string once compressed, in bits
+    long encodedBits(const PooledString &string) const {
+        long bits = codes.at(stringEnd).size();
+        for (int symbol : string.symbols) {
+            bits += codes.at(symbol).size();
+        }
+        return bits;
+    }
+    int encodedSize(const PooledString &string) const {
+        return 1 + (encodedBits(string) + 7) / 8;
+    }
+    // the nodes visited printing a string: one per bit and one per symbol
+    long decodeSteps(const PooledString &string) const {
+        return encodedBits(string) + string.symbols.size() + 1;
+    }
+    int getTableSize() const {
+        return tableSize;
+    }
+    unsigned abbreviationCount() const {
+        return abbreviations.size();
+    }
+
+    AsmData* encode(GameData &gamedata, const PooledString &string) const {
+        AsmData *data = gamedata.arena.make<AsmData>();
+        data->pushByte(0xE1);
+        unsigned current = 0, used = 0;
+        auto put = [&](const std::vector<bool> &code) {
+            for (bool bit : code) {
+                current |= bit << used;
+                if (++used == 8) {
+                    data->pushByte(current);
+                    current = used = 0;
+                }
+            }
+        };
+        for (int symbol : string.symbols) {
+            put(codes.at(symbol));
+        }
+        put(codes.at(stringEnd));
+        if (used > 0) {
+            data->pushByte(current);
+        }
+        return data;
+    }
+
+    AsmData* table(GameData &gamedata) const {
+        AsmData *data = gamedata.arena.make<AsmData>();
+        data->pushWord(tableSize);
+        data->pushWord(nodes.size());
+        data->pushWord(nodes[root].address);
+        writeNode(data, root);
+        return data;
+    }
+
+private:
+    class Run {
+    public:
+        Run()
+        : count(0), symbols(nullptr), start(0), length(0)
+        { }
+
+        int count;
+        const std::vector<int> *symbols;
+        size_t start, length;
+    };
+
+    class Candidate {
+    public:
+        Candidate(const std::u32string &text, int count)
+        : text(text), count(count)
+        { }
+
+        std::u32string text;
+        // how often it appears outside the abbreviations taken so far
+        int count;
+    };
+
+    static const uint64_t runHashSeed = 0xCBF29CE484222325ULL;
+    static uint64_t extendHash(uint64_t hash, int symbol) {
+        return (hash ^ static_cast<uint32_t>(symbol)) * 0x100000001B3ULL;
+    }
+
+    static int abbreviationScore(int length, int count) {
+        return count * (length - 1) - (length + 2);
+    }
+
+    static std::u32string window(const std::vector<int> &symbols, size_t start, size_t length) {
+        return std::u32string(symbols.begin() + start, symbols.begin() + start + length);
+    }
+
+    /* Replaces every occurrence of an abbreviation's text with its symbol.
+     * Each run of text that overlapped a replaced occurrence is gone, so it
+     * is taken off the counts as well.
+     */
+    void replace(const std::vector<PooledString*> &strings, const std::u32string &text, int symbol) {
+        for (PooledString *string : strings) {
+            std::vector<int> &symbols = string->symbols;
+            std::vector<int> out;
+            out.reserve(symbols.size());
+            size_t counted = 0;
+            for (size_t i = 0; i < symbols.size(); ) {
+                if (i + text.size() > symbols.size()
+                        || !std::equal(text.begin(), text.end(), symbols.begin() + i)) {
+                    out.push_back(symbols[i]);
+                    ++i;
+                    continue;
+                }
+                size_t end = i + text.size();
+                size_t first = i + 1 > maxAbbreviationLength ? i + 1 - maxAbbreviationLength : 0;
+                for (size_t start = std::max(first, counted); start < end; ++start) {
+                    uint64_t hash = extendHash(runHashSeed, symbols[start]);
+                    for (size_t length = 2; length <= maxAbbreviationLength
+                            && start + length <= symbols.size(); ++length) {
+                        hash = extendHash(hash, symbols[start + length - 1]);
+                        if (start + length <= i) {
+                            continue;
+                        }
+                        auto candidate = candidateOf.find(hash);
+                        if (candidate == candidateOf.end()) {
+                            continue;
+                        }
+                        Candidate &overlapped = candidates[candidate->second];
+                        if (overlapped.text.size() == length && std::equal(symbols.begin() + start,
+                                symbols.begin() + start + length, overlapped.text.begin())) {
+                            --overlapped.count;
+                        }
+                    }
+                }
+                counted = end;
+                out.push_back(symbol);
+                i = end;
+            }
+            symbols.swap(out);
+        }
+    }
+
+    static bool isLatin1(const std::u32string &text) {
+        for (char32_t c : text) {
+            if (c > 0xFF) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int nodeSize(const HuffmanNode &node) const {
+        if (!node.isLeaf()) {
+            return 9;
+        } else if (node.symbol == stringEnd) {
+            return 1;
+        } else if (node.symbol < 0x100) {
+            return 2;
+        } else if (node.symbol < firstAbbreviation) {
+            return 5;
+        }
+        const std::u32string &text = abbreviations[node.symbol - firstAbbreviation];
+        return isLatin1(text) ? text.size() + 2 : text.size() * 4 + 5;
+    }
+
+    // gives the nodes their codes and addresses, in the order they are written
+    void assign(int index, std::vector<bool> &code, int address) {
+        HuffmanNode &node = nodes[index];
+        node.address = address + tableSize;
+        tableSize += nodeSize(node);
+        if (node.isLeaf()) {
+            codes[node.symbol] = code;
+            return;
+        }
+        code.push_back(false);
+        assign(node.left, code, address);
+        code.back() = true;
+        if (node.right != node.left) {
+            assign(node.right, code, address);
+        }
+        code.pop_back();
+    }
+
+    void writeNode(AsmData *data, int index) const {
+        const HuffmanNode &node = nodes[index];
+        if (!node.isLeaf()) {
+            data->pushByte(nodeBranch);
+            data->pushWord(nodes[node.left].address);
+            data->pushWord(nodes[node.right].address);
+            writeNode(data, node.left);
+            if (node.right != node.left) {
+                writeNode(data, node.right);
+            }
+        } else if (node.symbol == stringEnd) {
+            data->pushByte(nodeEnd);
+        } else if (node.symbol < 0x100) {
+            data->pushByte(nodeChar);
+            data->pushByte(node.symbol);
+        } else if (node.symbol < firstAbbreviation) {
+            data->pushByte(nodeUnicodeChar);
+            data->pushWord(node.symbol);
+        } else {
+            const std::u32string &text = abbreviations[node.symbol - firstAbbreviation];
+            if (isLatin1(text)) {
+                data->pushByte(nodeCString);
+                for (char32_t c : text) {
+                    data->pushByte(c);
+                }
+                data->pushByte(0);
+            } else {
+                data->pushByte(nodeUnicodeString);
+                for (char32_t c : text) {
+                    data->pushWord(c);
+                }
+                data->pushWord(0);
+            }
+        }
+    }
+
+    std::vector<Candidate> candidates;
+    std::unordered_map<uint64_t, int> candidateOf;
+    std::vector<std::u32string> abbreviations;
+    std::vector<HuffmanNode> nodes;
+    std::unordered_map<int, std::vector<bool>> codes;
+    int root;
+    int tableSize;
+};
+
+
+/* ************************************************************ *
+ * PLACEMENT                                                    *
+ * ************************************************************ */
+
+class StringPlacer {
+public:
+    StringPlacer(GameData &gamedata)
+    : gamedata(gamedata), references(0), totalSize(0),
+      compressing(false), chosenCount(0), compressedCount(0), keptHot(0), keptShort(0), plainBytes(0), plainSteps(0),
+      compressedBytes(0), compressedSteps(0)
+    { }
+
+    void collect(const std::vector<AsmLine*> &lines) {
+        for (AsmLine *line : lines) {
+            AsmStatement *stmt = nodeAs<AsmStatement>(line);
+            if (!stmt) {
+                continue;
+            }
+            for (AsmOperand *op : stmt->operands) {
+                if (op->isStack || op->value->type != Value::String) {
+                    continue;
+                }
+                ++references;
+                auto known = indexOf.find(op->value->text);
+                if (known == indexOf.end()) {
+                    known = indexOf.insert(std::make_pair(op->value->text, strings.size())).first;
+                    addString(op->value->text);
+                }
+                ++strings[known->second].references;
+                uses.push_back(std::make_pair(op, known->second));
+            }
+        }
+    }
+
+    /* Picks the strings to compress and builds the decoding table for them.
+     * Strings that are used from many places stay as they are, as do those
+     * compression would not make smaller, and if the table costs more than
+     * compressing saves then nothing is compressed at all.
+     */
+    void compress() {
+        compressing = true;
+        std::vector<PooledString*> candidates;
+        for (PooledString &string : strings) {
+            if (string.references >= hotReferences) {
+                ++keptHot;
+            } else {
+                candidates.push_back(&string);
+            }
+        }
+        if (candidates.empty()) {
+            return;
+        }
+        compressor.chooseAbbreviations(candidates);
+        compressor.buildTree(candidates, firstLineAddress);
+
+        std::vector<PooledString*> chosen;
+        for (PooledString *string : candidates) {
+            if (compressor.encodedSize(*string) < string->plainSize()) {
+                chosen.push_back(string);
+            } else {
+                ++keptShort;
+            }
+        }
+        if (chosen.empty()) {
+            return;
+        }
+        compressor.buildTree(chosen, firstLineAddress);
+
+        chosenCount = chosen.size();
+        for (PooledString *string : chosen) {
+            plainBytes += string->plainSize();
+            plainSteps += string->chars.size() + 1;
+            compressedBytes += compressor.encodedSize(*string);
+            compressedSteps += compressor.decodeSteps(*string);
+        }
+        if (compressedBytes + compressor.getTableSize() >= plainBytes) {
+            return;
+        }
+        for (PooledString *string : chosen) {
+            string->compressed = true;
+        }
+        compressedCount = chosen.size();
+    }
+
+    /* Puts the strings ahead of the code and points the operands at them.
+     * The decoding table goes first of all, since it was laid out for the
+     * address the first line is placed at.
+     */
+    void place(std::vector<AsmLine*> &lines) {
+        std::vector<AsmLine*> out;
+        if (compressedCount > 0) {
+            out.push_back(gamedata.arena.make<LabelStmt>(Name("decoding.table")));
+            out.push_back(compressor.table(gamedata));
+            totalSize += compressor.getTableSize();
+        }
+        for (PooledString &string : strings) {
+            if (string.compressed) {
+                out.push_back(gamedata.arena.make<LabelStmt>(string.label));
+                AsmData *data = compressor.encode(gamedata, string);
+                totalSize += data->data.size();
+                out.push_back(data);
+                continue;
+            }
+            emit(string, out);
+        }
+        out.insert(out.end(), lines.begin(), lines.end());
+        lines.swap(out);
+
+        std::vector<Value*> labels;
+        for (const PooledString &string : strings) {
+            labels.push_back(gamedata.arena.make<Value>(string.label));
+        }
+        for (auto &use : uses) {
+            use.first->value = labels[use.second];
+        }
+    }
+
+    void report(std::ostream &out) const {
+        int latin1Count = 0, unicodeCount = 0;
+        for (const PooledString &string : strings) {
+            if (string.compressed) {
+                continue;
+            }
+            if (string.latin1) {
+                ++latin1Count;
+            } else {
+                ++unicodeCount;
+            }
+        }
+        out << "STRINGS\n";
+        out << "    references: " << references << ", distinct: " << strings.size() << '\n';
+        out << "    E0 (Latin-1): " << latin1Count << ", E2 (Unicode): " << unicodeCount
+            << ", E1 (compressed): " << compressedCount << '\n';
+        out << "    total size: " << totalSize << " bytes\n";
+        if (!compressing) {
+            return;
+        }
+        out << "    left uncompressed: " << keptHot << " used often, "
+            << keptShort << " no smaller compressed\n";
+        if (plainBytes == 0) {
+            return;
+        }
+        // decoding cost is the number of characters or table nodes visited
+        out << std::fixed << std::setprecision(1);
+        out << "    plain: " << plainBytes << " bytes, "
+            << static_cast<double>(plainSteps) / chosenCount << " steps per string\n";
+        out << "    compressed: " << compressedBytes << " bytes + "
+            << compressor.getTableSize() << " byte table ("
+            << compressor.abbreviationCount() << " abbreviations), "
+            << static_cast<double>(compressedSteps) / chosenCount << " steps per string";
+        out << (compressedCount > 0 ? "\n" : ", not used\n");
+        out.unsetf(std::ios_base::floatfield);
+        out << std::setprecision(6);
+    }
+
+private:
+    void addString(const Name &handle) {
+        PooledString string;
+        string.handle = handle;
+        // a dot keeps the label apart from anything declared in the source
+        std::stringstream ss;
+        ss << "str." << strings.size();
+        string.label = Name(ss.str());
+        // the lexer has already checked that strings are valid UTF-8
+        const std::string &text = handle.str();
+        std::string::const_iterator cur = text.cbegin();
+        while (cur != text.cend()) {
+            unsigned c = utf8::unchecked::next(cur);
+            string.chars.push_back(c);
+            if (c > 0xFF) {
+                string.latin1 = false;
+            }
+        }
+        strings.push_back(string);
+    }
+
+    // writes out a string as E0 or E2
+    void emit(const PooledString &string, std::vector<AsmLine*> &out) {
+        out.push_back(gamedata.arena.make<LabelStmt>(string.label));
+        AsmData *data = gamedata.arena.make<AsmData>();
+        if (string.latin1) {
+            data->pushByte(0xE0);
+            for (unsigned c : string.chars) {
+                data->pushByte(c);
+            }
+            data->pushByte(0);
+        } else {
+            data->pushWord(0xE2000000);
+            for (unsigned c : string.chars) {
+                data->pushWord(c);
+            }
+            data->pushWord(0);
+        }
+        totalSize += data->data.size();
+        out.push_back(data);
+    }
+
+    GameData &gamedata;
+    std::vector<PooledString> strings;
+    std::unordered_map<Name, int> indexOf;
+    std::vector<std::pair<AsmOperand*, int>> uses;
+    int references;
+    int totalSize;
+
+    Compressor compressor;
+    bool compressing;
+    int chosenCount;
+    int compressedCount;
+    int keptHot;
+    int keptShort;
+    // the strings chosen for compression, as plain and compressed strings
+    long plainBytes, plainSteps;
+    long compressedBytes, compressedSteps;
+};
+
+void placeStrings(GameData &gamedata, std::vector<AsmLine*> &lines, bool compress, bool showReport,
+                  std::ostream &out) {
+    StringPlacer placer(gamedata);
+    placer.collect(lines);
+    if (compress) {
+        placer.compress();
+    }
+    placer.place(lines);
+    if (showReport) {
+        placer.report(out);
+    }
+}
@@ -0,0 +1,108 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gbuilder.h"
+#include "flatcode.h"
+
+/* Leaves out the functions and data that the game can never use. The lines
+ * are cut into sections, each starting at a label followed by data. Starting
+ * from main and any exported names, every section that something reachable
+ * refers to is kept and the rest are dropped. String literals are not placed
+ * until after this, so only the ones kept code uses are ever written.
+ */
+
+class Section {
+public:
+    Section()
+    : begin(0), end(0), size(0), kept(false)
+    { }
+
+    size_t begin, end;
+    int size;
+    bool kept;
+};
+
+void stripUnreachable(std::vector<AsmLine*> &lines, const std::vector<std::string> &exports,
+                      ErrorLogger &errors, bool showReport, std::ostream &out) {
+    std::vector<Section> sections;
+    std::unordered_map<Name, int> sectionOf;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (sections.empty() || startsSection(lines, i)) {
+            sections.push_back(Section());
+            sections.back().begin = i;
+        }
+        sections.back().end = i + 1;
+        sections.back().size += lines[i]->getSize();
+        LabelStmt *label = nodeAs<LabelStmt>(lines[i]);
+        if (label) {
+            sectionOf[label->name] = sections.size() - 1;
+        }
+    }
+
+    // without main there is nothing to start from, so keep everything
+    auto mainSection = sectionOf.find(Name("main"));
+    if (mainSection == sectionOf.end()) {
+        return;
+    }
+    std::vector<int> pending;
+    pending.push_back(mainSection->second);
+    for (const std::string &name : exports) {
+        auto exported = sectionOf.find(Name(name));
+        if (exported == sectionOf.end()) {
+            errors.add(ErrorLogger::Error, Origin(), "exported name " + name + " is not defined.");
+            continue;
+        }
+        pending.push_back(exported->second);
+    }
+
+    while (!pending.empty()) {
+        Section &section = sections[pending.back()];
+        pending.pop_back();
+        if (section.kept) {
+            continue;
+        }
+        section.kept = true;
+        for (size_t i = section.begin; i < section.end; ++i) {
+            AsmStatement *stmt = nodeAs<AsmStatement>(lines[i]);
+            if (!stmt) {
+                continue;
+            }
+            for (AsmOperand *op : stmt->operands) {
+                if (op->isStack || op->value->type != Value::Identifier) {
+                    continue;
+                }
+                auto used = sectionOf.find(op->value->text);
+                if (used != sectionOf.end()) {
+                    pending.push_back(used->second);
+                }
+            }
+        }
+    }
+
+    std::vector<AsmLine*> kept;
+    kept.reserve(lines.size());
+    int strippedCount = 0, strippedSize = 0;
+    if (showReport) {
+        out << "STRIPPED\n";
+    }
+    for (const Section &section : sections) {
+        if (section.kept) {
+            kept.insert(kept.end(), lines.begin() + section.begin, lines.begin() + section.end);
+            continue;
+        }
+        ++strippedCount;
+        strippedSize += section.size;
+        if (showReport) {
+            LabelStmt *label = nodeAs<LabelStmt>(lines[section.begin]);
+            out << std::setw(8) << section.size << "  "
+                << (label ? label->name.str() : "(unnamed)") << '\n';
+        }
+    }
+    if (showReport) {
+        out << "    " << strippedCount << " function(s) and string(s), " << strippedSize << " bytes\n";
+    }
+    lines.swap(kept);
+}
@@ -1,27 +1,49 @@
 #include "gbuilder.h"
 
+// scopes with up to this many symbols have no hash table
+static const size_t smallScope = 8;
 
-SymbolDef* SymbolTable::get(const std::string &name) {
-    if (symbols.count(name) > 0) {
-        return symbols.at(name);
+// spreads out names, whose ids are handed out one after another
+static size_t slotFor(const Name &name, size_t mask) {
+    return (static_cast<uint32_t>(name.getId()) * 2654435769u) & mask;
+}
+
+SymbolDef* SymbolTable::get(const Name &name) {
+    for (SymbolTable *scope = this; scope; scope = scope->parent) {
+        SymbolDef *symbol = scope->find(name);
+        if (symbol) {
+            return symbol;
         }
+    }
+    return nullptr;
+}
 
-    if (parent) {
-        return parent->get(name);
-    } else {
+SymbolDef* SymbolTable::find(const Name &name) const {
+    if (slots.empty()) {
+        for (SymbolDef *symbol : declared) {
+            if (symbol->name == name) {
+                return symbol;
+            }
+        }
         return nullptr;
     }
-}
 
-bool SymbolTable::exists(const std::string &name) const {
-    if (symbols.count(name) > 0) {
-        return true;
+    size_t mask = slots.size() - 1;
+    for (size_t slot = slotFor(name, mask); slots[slot]; slot = (slot + 1) & mask) {
+        if (slots[slot]->name == name) {
+            return slots[slot];
+        }
     }
-    if (parent) {
-        return parent->exists(name);
-    } else {
-        return false;
+    return nullptr;
+}
+
+bool SymbolTable::exists(const Name &name) const {
+    for (const SymbolTable *scope = this; scope; scope = scope->parent) {
+        if (scope->find(name)) {
+            return true;
+        }
     }
+    return false;
 }
 
 void SymbolTable::add(SymbolDef *symbol, bool functionScope) {
@@ -29,13 +51,65 @@ void SymbolTable::add(SymbolDef *symbol, bool functionScope) {
         return;
     }
 
+    SymbolTable *scope = this;
     if (functionScope && parent) {
-        SymbolTable *cur = this;
-        while (cur->parent->parent != nullptr) {
-            cur = cur->parent;
+        while (scope->parent->parent != nullptr) {
+            scope = scope->parent;
+        }
+    }
+    scope->insert(symbol);
+}
+
+void SymbolTable::insert(SymbolDef *symbol) {
+    declared.push_back(symbol);
+    if (declared.size() <= smallScope) {
+        return;
+    }
+    // kept at most half full, so probe sequences stay short
+    if (declared.size() * 2 > slots.size()) {
+        rehash(slots.empty() ? smallScope * 4 : slots.size() * 2);
+        return;
+    }
+    size_t mask = slots.size() - 1;
+    size_t slot = slotFor(symbol->name, mask);
+    while (slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = symbol;
+}
+
+void SymbolTable::clear() {
+    declared.clear();
+    slots.clear();
+}
+
+void SymbolTable::rehash(size_t capacity) {
+    slots.assign(capacity, nullptr);
+    size_t mask = capacity - 1;
+    for (SymbolDef *symbol : declared) {
+        size_t slot = slotFor(symbol->name, mask);
+        while (slots[slot]) {
+            slot = (slot + 1) & mask;
         }
-        cur->add(symbol, false);
-    } else {
-        symbols.insert({symbol->name, symbol});
+        slots[slot] = symbol;
+    }
+}
+
+void SymbolDef::bind(Value &use, const FunctionDef *function) const {
+    switch (type) {
+        case Constant:
+            use.value = value;
+            use.type = Value::Constant;
+            break;
+        case Local:
+            use.value = value;
+            use.type = Value::Local;
+            break;
+        case Label:
+            use.text = function->labels[value];
+            break;
+        default:
+            // anything else is placed in the game and found by its name
+            break;
     }
 }
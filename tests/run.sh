@@ -0,0 +1,87 @@
+#!/bin/sh
+# Builds the test projects in tests/ and compares everything gbuilder
+# prints for each with the output expected of it. Run from the top of the
+# tree, normally through "make check". Differences are shown and the run
+# fails.
+
+top=$(pwd)
+gbuilder="$top/gbuilder"
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cp tests/*.gc tests/*.proj "$work"
+failed=0
+
+# check NAME [OPTIONS...]: builds NAME.proj with the options given and
+# compares what is printed with NAME.expected
+check() {
+    name=$1
+    shift
+    (cd "$work" && "$gbuilder" "$name.proj" "$@" > "$name.out" 2>&1)
+    if diff -u "tests/$name.expected" "$work/$name.out"; then
+        echo "ok      $name"
+    else
+        echo "FAILED  $name"
+        failed=1
+    fi
+}
+
+# expect DESCRIPTION CONDITION: reports whether a shell condition holds
+expect() {
+    if (cd "$work" && eval "$2"); then
+        echo "ok      $1"
+    else
+        echo "FAILED  $1"
+        failed=1
+    fi
+}
+
+# the number of cache entries, and how many were written since the stamp
+entries() {
+    ls "$work/cache.dir" | wc -l
+}
+rewritten() {
+    find "$work/cache.dir" -type f -newer "$work/stamp" | wc -l
+}
+
+# a use binds to the closest declaration, even one further on
+check shadow -asm -O0
+
+# globals declared in two files are reported where each declaration is
+check duplicate
+
+# widening one jump can push another out of reach, and both are widened
+check relax -labels -O0
+
+# each peephole rule is used at least once
+check peephole -asm -report -O2
+
+# jumps through jumps are threaded and blocks never reached are removed
+check cfg -asm -report -O1
+
+# after a mistake the parser starts again at the next statement, block or
+# top level declaration, and reports only real mistakes; with -errors it
+# gives up on a file after that many, but still parses the other files
+check recover
+check recover_limit -errors 2
+
+# a second build reads both files back from the cache and writes the same
+# game; after an edit only that file is parsed again, and entries that
+# can't be read are parsed again too
+check cache -asm
+cp "$work/cache.ulx" "$work/first.ulx"
+# file times are coarse, so leave a clear gap after the stamp
+touch "$work/stamp"
+sleep 1
+check cache -asm
+expect "cache: same game from cached files" 'cmp -s cache.ulx first.ulx'
+expect "cache: nothing parsed again" '[ $(entries) -eq 2 ] && [ $(rewritten) -eq 0 ]'
+sed 's/answer = 1/answer = 2/' "$work/cache_lib.gc" > "$work/edited.gc"
+mv "$work/edited.gc" "$work/cache_lib.gc"
+check cache_edited -asm
+expect "cache: edited file parsed again" '[ $(entries) -eq 3 ] && [ $(rewritten) -eq 1 ]'
+for entry in "$work"/cache.dir/*; do
+    : > "$entry"
+done
+check cache_edited -asm
+
+exit $failed